@@ -1,13 +1,18 @@
 #include <stdio.h>
+#include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/ioctl.h>
-#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 #include <stdint.h>
 #include <signal.h>
+#include <unistd.h>
 #include "driver/openvfd_drv.h"
 
 #define UNUSED(x)	(void*)(x)
@@ -27,10 +32,6 @@ int get_cmd_chars_order(int argc, char *argv[], u_int8 chars[], const int sz);
 bool print_usage(int argc, char *argv[]);
 
 struct sync_data {
-	bool isActive;
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
-	struct timespec abs_time;
 	bool useBuffer;
 	union {
 		struct vfd_display_data display_data;
@@ -63,6 +64,8 @@ static DotLedBitMap dotLeds[LED_DOT_MAX] = {
 
 #define LEDCODES_LEN	(sizeof(LED_decode_tab1)/sizeof(LED_decode_tab1[0]))
 static const led_bitmap *ledCodes = LED_decode_tab1;
+static const led_bitmap *ledLutCodes = NULL;
+static u_int8 ledLut[256];
 static struct vfd_display display_type;
 
 int openvfd_fd;
@@ -71,18 +74,9 @@ bool verbose = false;
 
 uint8_t char_to_mask(uint8_t ch)
 {
-	unsigned int index = 0;
 	if (display_type.controller > CONTROLLER_7S_MAX)
 		return ch;
-	else {
-		for (index = 0; index < LEDCODES_LEN; index++) {
-			if (ledCodes[index].character == ch) {
-				return ledCodes[index].bitmap;
-			}
-		}
-	}
-
-	return LED_MASK_VOID;
+	return ledLut[ch];
 }
 
 void mdelay(int n)
@@ -94,16 +88,325 @@ void mdelay(int n)
 
 struct sync_data sync_data;
 
-void led_display_loop(const struct display_setup *setup)
+void update_display_data(const struct display_setup *setup, struct vfd_display_data *data, bool *use_user_string)
+{
+	struct timespec now;
+	struct tm *timenow;
+
+	if (sync_data.useBuffer && (sync_data.display_data.mode == DISPLAY_MODE_CLOCK ||
+			sync_data.display_data.mode == DISPLAY_MODE_DATE)) {
+		*use_user_string = false;
+		sync_data.useBuffer = false;
+		sync_data.display_data.colon_on = data->colon_on;
+		*data = sync_data.display_data;
+	}
+
+	if (sync_data.useBuffer) {
+		*use_user_string = false;
+		*data = sync_data.display_data;
+		return;
+	}
+
+	// Get current time, the colon is lit during the first half of every second.
+	clock_gettime(CLOCK_REALTIME, &now);
+	timenow = localtime(&now.tv_sec);
+
+	if (setup->is_demo) {
+		data->mode = 1 + timenow->tm_sec / 12;
+		data->temperature = timenow->tm_hour + timenow->tm_min + timenow->tm_sec;
+		data->channel_data.channel = (u_int16)10*(timenow->tm_hour + timenow->tm_min + timenow->tm_sec);
+		data->channel_data.channel_count = (u_int16)86400;
+		data->time_date.hours = ((timenow->tm_sec >= 24) && (timenow->tm_sec < 30)) ? 0 : (timenow->tm_hour == 0) ? 24 : timenow->tm_hour;
+		data->time_date.minutes = timenow->tm_min;
+		data->time_date.seconds = timenow->tm_sec;
+		data->time_date.day_of_week = timenow->tm_wday;
+		data->time_date.day = timenow->tm_mday;
+		data->time_date.month = timenow->tm_mon;
+		data->time_date.year = timenow->tm_year + 1900;
+		data->time_secondary.hours = timenow->tm_hour;
+		data->time_secondary.minutes = timenow->tm_min;
+		data->time_secondary.seconds = timenow->tm_sec;
+		data->colon_on = now.tv_nsec < (long)5E8;
+		// Really long movie title.
+		snprintf(data->string_main, sizeof(data->string_secondary), "The Saga of the Viking Women and their Voyage to the Waters of the Great Sea Serpent");
+		snprintf(data->string_secondary, sizeof(data->string_secondary), "Now playing:");
+	} else if (!*use_user_string) {
+		if (data->mode != DISPLAY_MODE_DATE)
+			data->mode = DISPLAY_MODE_CLOCK;
+		if (setup->is_12h) {
+			if (timenow->tm_hour == 0)
+				data->time_date.hours = 12;
+			else if (timenow->tm_hour > 12)
+				data->time_date.hours = timenow->tm_hour - 12;
+			else
+				data->time_date.hours = timenow->tm_hour;
+		} else {
+			data->time_date.hours = timenow->tm_hour;
+		}
+		data->time_date.minutes = timenow->tm_min;
+		data->time_date.seconds = timenow->tm_sec;
+		data->time_date.day_of_week = timenow->tm_wday;
+		data->time_date.day = timenow->tm_mday;
+		data->time_date.month = timenow->tm_mon;
+		data->time_date.year = timenow->tm_year + 1900;
+		data->colon_on = now.tv_nsec < (long)5E8;
+	}
+}
+
+/*
+ * Returns true if the display should be refreshed.
+ */
+bool handle_pipe_message(const char *buf, int ret)
+{
+	bool refresh = true;
+	int i;
+
+	if (verbose) {
+		printf("ret = %d, %.*s\n", ret, ret, buf);
+		for (i = 0; i < ret; i++)
+			printf("0x%02X, ", (unsigned char)buf[i]);
+		printf("\n");
+	}
+	if (ret == sizeof(sync_data.display_data)) {
+		VERBOSE_PRINTF("Write display data\n");
+		memcpy(&sync_data.display_data, buf, sizeof(sync_data.display_data));
+		sync_data.useBuffer = true;
+	} else {
+		VERBOSE_PRINTF("Write unknown data\n");
+		switch ((unsigned char)buf[0]) {
+		case 0:
+		default:
+			VERBOSE_PRINTF("case 0, default\n");
+			sync_data.useBuffer = true;
+			sync_data.display_data.mode = DISPLAY_MODE_CLOCK;
+			break;
+		case 1:
+			// Refresh display.
+			break;
+		case 2:
+			if (ret >= 3 && buf[1] == DISPLAY_MODE_DATE)
+			{
+				if (sync_data.display_data.mode == DISPLAY_MODE_DATE)
+					refresh = false;
+				else
+					sync_data.display_data.mode = DISPLAY_MODE_DATE;
+				sync_data.display_data.time_secondary._reserved = buf[2];
+				sync_data.useBuffer = true;
+			}
+			break;
+		}
+	}
+
+	return refresh;
+}
+
+// Read only, so the fifo reports EOF once the last client closed it.
+int reopen_named_pipe(void)
+{
+	int fd = open(PIPE_PATH, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		printf("Unable to open the fifo; errno=%d\n",errno);
+	return fd;
+}
+
+int open_named_pipe(void)
+{
+	unlink(PIPE_PATH);
+	if ((mkfifo(PIPE_PATH, 0666)) != 0) {
+		printf("Unable to create a fifo; errno=%d\n",errno);
+		return -1;
+	}
+	return reopen_named_pipe();
+}
+
+/*
+ * The tick timer is armed on absolute wall clock deadlines, at the next edge
+ * of period_ms (0 disarms it). Half second edges also cover every second and
+ * minute rollover. Setting the clock cancels the timer, so it is re-armed
+ * against the new time instead of firing late or early.
+ */
+#define TICK_CLOCK_MS		500
+#define TICK_TZ_CHECK_MS	(30 * 60 * 1000)
+
+bool arm_tick_timer(int fd, long period_ms)
+{
+	struct itimerspec spec = { 0 };
+	if (period_ms > 0) {
+		long long next_ms;
+		clock_gettime(CLOCK_REALTIME, &spec.it_value);
+		next_ms = (spec.it_value.tv_sec * 1000LL + spec.it_value.tv_nsec / 1000000) / period_ms;
+		next_ms = (next_ms + 1) * period_ms;
+		spec.it_value.tv_sec = next_ms / 1000;
+		spec.it_value.tv_nsec = (next_ms % 1000) * 1000000;
+	}
+	return !timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL);
+}
+
+/*
+ * Hands the clock over to the driver, which then keeps it ticking by itself.
+ * Only sends the configuration when it changed, returns false if the driver
+ * has no autonomous clock.
+ */
+bool set_kernel_clock(const struct display_setup *setup, const struct vfd_display_data *data, struct vfd_clock_config *current)
+{
+	struct vfd_clock_config config = { 0 };
+	time_t now = time(NULL);
+	struct tm tm;
+
+	localtime_r(&now, &tm);
+	config.enabled = 1;
+	config.flags = (setup->is_12h ? VFD_CLOCK_FLAG_12H : 0) | (data->mode == DISPLAY_MODE_DATE ? VFD_CLOCK_FLAG_DATE : 0);
+	config.date_format = data->time_secondary._reserved;
+	config.utc_offset = (int)tm.tm_gmtoff;
+	if (!memcmp(&config, current, sizeof(config)))
+		return true;
+	if (ioctl(openvfd_fd, VFD_IOC_SCLOCK, &config))
+		return false;
+	VERBOSE_PRINTF("Driver clock enabled\n");
+	*current = config;
+	return true;
+}
+
+int open_signal_fd(void)
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL))
+		return -1;
+	return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+bool epoll_add(int epoll_fd, int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+	return fd >= 0 && !epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Clients may write faster than the service reads, so the fifo is a stream.
+ * It is split into struct vfd_display_data records, a partial record is kept
+ * for the next read. Whatever is left when the last client closed the fifo are
+ * short commands, 2 is followed by two argument bytes and the others stand
+ * alone. The fifo is then reopened, or it would keep reporting EOF.
+ */
+bool read_named_pipe(int epoll_fd, int *pipe_fd)
+{
+	static char buf[sizeof(struct vfd_display_data)];
+	static size_t length = 0;
+	bool refresh = false;
+	size_t pos, size;
+	int ret;
+
+	while ((ret = read(*pipe_fd, buf + length, sizeof(buf) - length)) > 0) {
+		length += ret;
+		if (length == sizeof(buf)) {
+			refresh |= handle_pipe_message(buf, length);
+			length = 0;
+		}
+	}
+	if (ret == 0) {
+		for (pos = 0; pos < length; pos += size) {
+			size = buf[pos] == 2 && length - pos >= 3 ? 3 : 1;
+			refresh |= handle_pipe_message(buf + pos, size);
+		}
+		length = 0;
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, *pipe_fd, NULL);
+		close(*pipe_fd);
+		*pipe_fd = reopen_named_pipe();
+		if (!epoll_add(epoll_fd, *pipe_fd))
+			printf("Named pipe is no longer available, continuing without it.\n");
+	}
+	return refresh;
+}
+
+bool append_delta_record(unsigned char *buf, size_t size, size_t *pos, u_int8 tag, u_int16 offset, const void *src, u_int8 length)
+{
+	struct vfd_delta_record record = { .tag = tag, .length = length, .offset = offset };
+	if (*pos + sizeof(record) + length > size)
+		return false;
+	memcpy(buf + *pos, &record, sizeof(record));
+	memcpy(buf + *pos + sizeof(record), src, length);
+	*pos += sizeof(record) + length;
+	((struct vfd_delta_header *)buf)->count++;
+	return true;
+}
+
+bool append_delta_field(unsigned char *buf, size_t size, size_t *pos, u_int8 tag, const void *old_field, const void *new_field, size_t field_size)
+{
+	if (!memcmp(old_field, new_field, field_size))
+		return true;
+	return append_delta_record(buf, size, pos, tag, 0, new_field, (u_int8)field_size);
+}
+
+/*
+ * Only the span between the first and the last changed character is sent,
+ * split into records of up to 255 bytes.
+ */
+bool append_delta_string(unsigned char *buf, size_t size, size_t *pos, u_int8 tag, const char *old_str, const char *new_str, size_t str_size)
+{
+	size_t first = 0, last = strnlen(new_str, str_size - 1);
+	size_t old_len = strnlen(old_str, str_size - 1);
+	if (old_len > last)
+		last = old_len;
+	while (first <= last && old_str[first] == new_str[first])
+		first++;
+	if (first > last)
+		return true;
+	while (old_str[last] == new_str[last])
+		last--;
+	while (first <= last) {
+		size_t length = last - first + 1;
+		if (length > 255)
+			length = 255;
+		if (!append_delta_record(buf, size, pos, tag, (u_int16)first, new_str + first, (u_int8)length))
+			return false;
+		first += length;
+	}
+	return true;
+}
+
+/*
+ * Builds a delta update from old_data to new_data, returns its size or 0 if
+ * the full frame is as small.
+ */
+size_t build_display_delta(unsigned char *buf, size_t size, const struct vfd_display_data *old_data, const struct vfd_display_data *new_data)
+{
+	struct vfd_delta_header *header = (struct vfd_delta_header *)buf;
+	size_t pos = sizeof(*header);
+	bool ret;
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, VFD_DELTA_MAGIC, sizeof(header->magic));
+	header->version = VFD_DELTA_VERSION;
+	ret = append_delta_field(buf, size, &pos, VFD_DELTA_MODE, &old_data->mode, &new_data->mode, sizeof(new_data->mode)) &&
+		append_delta_field(buf, size, &pos, VFD_DELTA_COLON, &old_data->colon_on, &new_data->colon_on, sizeof(new_data->colon_on)) &&
+		append_delta_field(buf, size, &pos, VFD_DELTA_TEMPERATURE, &old_data->temperature, &new_data->temperature, sizeof(new_data->temperature)) &&
+		append_delta_field(buf, size, &pos, VFD_DELTA_TIME_DATE, &old_data->time_date, &new_data->time_date, sizeof(new_data->time_date)) &&
+		append_delta_field(buf, size, &pos, VFD_DELTA_TIME_SECONDARY, &old_data->time_secondary, &new_data->time_secondary, sizeof(new_data->time_secondary)) &&
+		append_delta_field(buf, size, &pos, VFD_DELTA_CHANNEL, &old_data->channel_data, &new_data->channel_data, sizeof(new_data->channel_data)) &&
+		append_delta_string(buf, size, &pos, VFD_DELTA_STRING_MAIN, old_data->string_main, new_data->string_main, sizeof(new_data->string_main)) &&
+		append_delta_string(buf, size, &pos, VFD_DELTA_STRING_SECONDARY, old_data->string_secondary, new_data->string_secondary, sizeof(new_data->string_secondary));
+	return ret && pos < sizeof(*new_data) ? pos : 0;
+}
+
+int led_display_loop(const struct display_setup *setup)
 {
 	static struct vfd_display_data data = { 0 };
+	static struct vfd_display_data last_data = { 0 };
 	bool use_user_string = false;
-	int ret = -1;
-
-	time_t now;
-	struct tm *timenow;
+	bool is_active = true, is_first = true, has_written = false;
+	bool has_kernel_clock = !setup->is_demo;
+	bool has_delta = false;
+	int delta_version = 0;
+	unsigned char delta[sizeof(struct vfd_display_data)];
+	size_t delta_size;
+	struct vfd_clock_config clock_config = { 0 };
+	int epoll_fd, timer_fd, pipe_fd, signal_fd;
 
 	memset(&data, 0, sizeof(data));
+	memset(&sync_data, 0, sizeof(struct sync_data));
 
 	if (setup->user_string) {
 		use_user_string = true;
@@ -113,82 +416,82 @@ void led_display_loop(const struct display_setup *setup)
 			snprintf(data.string_secondary, sizeof(data.string_secondary), setup->secondary_user_string);
 	}
 
-	while(sync_data.isActive) {
-		if (!pthread_mutex_lock(&sync_data.mutex)) {
-			ret = pthread_cond_timedwait(&sync_data.cond, &sync_data.mutex, &sync_data.abs_time);
-			if (!ret || ret == ETIMEDOUT) {
-				clock_gettime(CLOCK_REALTIME, &sync_data.abs_time);
-				sync_data.abs_time.tv_nsec += (long)5E8;
-				if (sync_data.abs_time.tv_nsec >= (long)1E9) {
-					sync_data.abs_time.tv_nsec -= (long)1E9;
-					sync_data.abs_time.tv_sec++;
-				}
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	signal_fd = open_signal_fd();
+	timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	pipe_fd = open_named_pipe();
+	if (epoll_fd < 0 || !epoll_add(epoll_fd, signal_fd) || !epoll_add(epoll_fd, timer_fd)) {
+		perror("Failed to set up the event loop");
+		return -1;
+	}
+	if (!epoll_add(epoll_fd, pipe_fd))
+		printf("Named pipe is not available, continuing without it.\n");
 
-				select_display_type();
-				if (sync_data.useBuffer && (sync_data.display_data.mode == DISPLAY_MODE_CLOCK ||
-						sync_data.display_data.mode == DISPLAY_MODE_DATE)) {
-					use_user_string = false;
-					sync_data.useBuffer = false;
-					sync_data.display_data.colon_on = data.colon_on;
-					data = sync_data.display_data;
-				}
+	if (!ioctl(openvfd_fd, VFD_IOC_GDELTA_VERSION, &delta_version))
+		has_delta = delta_version == VFD_DELTA_VERSION;
 
-				if (sync_data.useBuffer) {
-					use_user_string = false;
-					data = sync_data.display_data;
-				} else {
-					// Get current time
-					time(&now);
-					timenow = localtime(&now);
-
-					if (setup->is_demo) {
-						data.mode = 1 + timenow->tm_sec / 12;
-						data.temperature = timenow->tm_hour + timenow->tm_min + timenow->tm_sec;
-						data.channel_data.channel = (u_int16)10*(timenow->tm_hour + timenow->tm_min + timenow->tm_sec);
-						data.channel_data.channel_count = (u_int16)86400;
-						data.time_date.hours = ((timenow->tm_sec >= 24) && (timenow->tm_sec < 30)) ? 0 : (timenow->tm_hour == 0) ? 24 : timenow->tm_hour;
-						data.time_date.minutes = timenow->tm_min;
-						data.time_date.seconds = timenow->tm_sec;
-						data.time_date.day_of_week = timenow->tm_wday;
-						data.time_date.day = timenow->tm_mday;
-						data.time_date.month = timenow->tm_mon;
-						data.time_date.year = timenow->tm_year + 1900;
-						data.time_secondary.hours = timenow->tm_hour;
-						data.time_secondary.minutes = timenow->tm_min;
-						data.time_secondary.seconds = timenow->tm_sec;
-						data.colon_on = !data.colon_on;
-						// Really long movie title.
-						snprintf(data.string_main, sizeof(data.string_secondary), "The Saga of the Viking Women and their Voyage to the Waters of the Great Sea Serpent");
-						snprintf(data.string_secondary, sizeof(data.string_secondary), "Now playing:");
-					} else if (!use_user_string) {
-						if (data.mode != DISPLAY_MODE_DATE)
-							data.mode = DISPLAY_MODE_CLOCK;
-						if (setup->is_12h) {
-							if (timenow->tm_hour == 0)
-								data.time_date.hours = 12;
-							else if (timenow->tm_hour > 12)
-								data.time_date.hours = timenow->tm_hour - 12;
-							else
-								data.time_date.hours = timenow->tm_hour;
-						} else {
-							data.time_date.hours = timenow->tm_hour;
-						}
-						data.time_date.minutes = timenow->tm_min;
-						data.time_date.seconds = timenow->tm_sec;
-						data.time_date.day_of_week = timenow->tm_wday;
-						data.time_date.day = timenow->tm_mday;
-						data.time_date.month = timenow->tm_mon;
-						data.time_date.year = timenow->tm_year + 1900;
-						data.colon_on = !data.colon_on;
-					}
-				}
-				ret = write(openvfd_fd,&data,sizeof(data));
+	select_display_type();
+	while (is_active) {
+		struct epoll_event events[3];
+		bool refresh = false, is_clock;
+		int i, n = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), is_first ? 0 : -1);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait failed");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == timer_fd) {
+				uint64_t expirations;
+				// Fails with ECANCELED after a clock change, refresh and re-arm in both cases.
+				read(timer_fd, &expirations, sizeof(expirations));
+				refresh = true;
+			} else if (events[i].data.fd == pipe_fd) {
+				if (read_named_pipe(epoll_fd, &pipe_fd))
+					refresh = true;
+			} else if (events[i].data.fd == signal_fd) {
+				struct signalfd_siginfo info;
+				if (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+					is_active = false;
 			}
-			pthread_mutex_unlock(&sync_data.mutex);
-		} else {
-			mdelay(500);
 		}
+
+		if (!is_active || !(refresh || is_first))
+			continue;
+		is_first = false;
+
+		select_display_type();
+		update_display_data(setup, &data, &use_user_string);
+		is_clock = !setup->is_demo && !use_user_string && !sync_data.useBuffer;
+		if (is_clock && has_kernel_clock && (has_kernel_clock = set_kernel_clock(setup, &data, &clock_config))) {
+			// Only wake up to follow time zone and DST changes.
+			arm_tick_timer(timer_fd, TICK_TZ_CHECK_MS);
+			has_written = false;
+			continue;
+		}
+		// Writing a frame disables the driver clock.
+		memset(&clock_config, 0, sizeof(clock_config));
+		// Only a clock needs ticks, static content is redrawn by pipe messages alone.
+		arm_tick_timer(timer_fd, (setup->is_demo || is_clock) ? TICK_CLOCK_MS : 0);
+		// Nothing changed since the last write (e.g. a static user string), leave the display alone.
+		if (has_written && !memcmp(&data, &last_data, sizeof(data)))
+			continue;
+		// Send only what changed since the last frame, if the driver supports it.
+		delta_size = has_written && has_delta ? build_display_delta(delta, sizeof(delta), &last_data, &data) : 0;
+		if (delta_size ? write(openvfd_fd, delta, delta_size) >= 0 : write(openvfd_fd, &data, sizeof(data)) >= 0) {
+			last_data = data;
+			has_written = true;
+		}
+	}
+
+	close(epoll_fd);
+	close(timer_fd);
+	close(signal_fd);
+	if (pipe_fd >= 0) {
+		close(pipe_fd);
+		unlink(PIPE_PATH);
 	}
+	return 0;
 }
 
 void led_test_codes()
@@ -311,85 +614,6 @@ void led_test_loop(bool cycle_display_types)
 	}
 }
 
-void *display_thread_handler(void *arg)
-{
-	struct display_setup *setup = (struct display_setup*)arg;
-	led_display_loop(setup);
-	pthread_exit(NULL);
-}
-
-void *display_test_thread_handler(void *arg)
-{
-	bool cycle_display_types = *(bool*)arg;
-	led_test_loop(cycle_display_types);
-	pthread_exit(NULL);
-}
-
-void *named_pipe_thread_handler(void *arg)
-{
-	int file;
-	char buf[1024];
-	int ret = 0, i;
-	unsigned char skipSignal;
-
-	unlink(PIPE_PATH);
-	if ((mkfifo(PIPE_PATH, 0666)) != 0) {
-		printf("Unable to create a fifo; errno=%d\n",errno);
-		pthread_exit(NULL);                    /* Print error message and return */
-	}
-
-	while (sync_data.isActive) {
-		file = open(PIPE_PATH, O_RDONLY);
-		ret = read(file, buf, sizeof(buf));
-		close(file);
-		buf[ret] = '\0';
-		if (verbose) {
-			printf("ret = %d, %s\n", ret, buf);
-			for (i = 0; i < ret; i++)
-				printf("0x%02X, ", buf[i]);
-			printf("\n");
-		}
-		if (ret > 0 && !pthread_mutex_lock(&sync_data.mutex)) {
-			skipSignal = 0;
-			if (ret == sizeof(sync_data.display_data)) {
-				VERBOSE_PRINTF("Write display data\n");
-				memcpy(&sync_data.display_data, buf, sizeof(sync_data.display_data));
-				sync_data.useBuffer = true;
-			} else {
-				VERBOSE_PRINTF("Write unknown data\n");
-				switch ((unsigned char)buf[0]) {
-				case 0:
-				default:
-					VERBOSE_PRINTF("case 0, default\n");
-					sync_data.useBuffer = true;
-					sync_data.display_data.mode = DISPLAY_MODE_CLOCK;
-					break;
-				case 1:
-					// Refresh display. Will signal the led_loop to update display.
-					break;
-				case 2:
-					if (ret >= 3 && buf[1] == DISPLAY_MODE_DATE)
-					{
-						if (sync_data.display_data.mode == DISPLAY_MODE_DATE)
-							skipSignal = 1;
-						else
-							sync_data.display_data.mode = DISPLAY_MODE_DATE;
-						sync_data.display_data.time_secondary._reserved = buf[2];
-						sync_data.useBuffer = true;
-					}
-					break;
-				}
-			}
-			if (!skipSignal)
-				pthread_cond_signal(&sync_data.cond);
-			pthread_mutex_unlock(&sync_data.mutex);
-		}
-	}
-
-	unlink(PIPE_PATH);
-	pthread_exit(NULL);
-}
-
 void select_display_type()
 {
 	if (!ioctl(openvfd_fd, VFD_IOC_GDISPLAY_TYPE, &display_type)) {
@@ -414,6 +638,11 @@ void select_display_type()
 		memset(&display_type, 0, sizeof(display_type));
 		perror("Failed to read display type, using default.");
 	}
+	// main() selects the display type first, so the table is built before char_to_mask() is used.
+	if (ledLutCodes != ledCodes) {
+		build_glyph_lut(ledLut, ledCodes, LEDCODES_LEN);
+		ledLutCodes = ledCodes;
+	}
 }
 
 bool set_display_type(int new_display_type)
@@ -428,22 +657,12 @@ bool set_display_type(int new_display_type)
 	return ret == 0;
 }
 
-void handle_signal(int signal)
-{
-	int file;
-	sync_data.isActive = false;
-	file = open(PIPE_PATH, O_WRONLY);
-	write(file, "\1", 1);
-	close(file);
-}
-
 int main(int argc, char *argv[])
 {
 	u_int8 char_indexes[7];
 	int ret, type, char_order_count;
 	bool test_mode = false;
 	bool cycle_display_types = true;
-	pthread_t disp_id, npipe_id = 0;
 
 	if (print_usage(argc, argv))
 		return 0;
@@ -465,34 +684,21 @@ int main(int argc, char *argv[])
 	select_display_type();
 
 	test_mode = is_test_mode(argc, argv);
-	if (test_mode)
-		ret = pthread_create(&disp_id, NULL, display_test_thread_handler, &cycle_display_types);
-	else {
+	if (test_mode) {
+		led_test_loop(cycle_display_types);
+		ret = 0;
+	} else {
 		struct display_setup setup = { 0 };
-		struct sigaction sig_handler = {.sa_handler=handle_signal};
-		memset(&sync_data, 0, sizeof(struct sync_data));
-		sync_data.isActive = true;
-		sigaction(SIGTERM, &sig_handler, 0);
-		sigaction(SIGINT, &sig_handler, 0);
 		setup.is_demo = is_demo_mode(argc, argv);
 		setup.is_12h = is_12h_mode(argc, argv);
 		setup.user_string = get_user_string(argc, argv);
 		if (setup.user_string)
 			setup.secondary_user_string = get_secondary_user_string(argc, argv);
-		ret = pthread_create(&disp_id, NULL, display_thread_handler, &setup);
-		if (ret == 0)
-			ret = pthread_create(&npipe_id, NULL, named_pipe_thread_handler, NULL);
-	}
-	if(ret != 0) {
-		perror("Create disp_id or npipe_id thread error\n");
-		return ret;
+		ret = led_display_loop(&setup);
 	}
 
-	if (npipe_id)
-		pthread_join(npipe_id, NULL);
-	pthread_join(disp_id, NULL);
 	close(openvfd_fd);
-	return 0;
+	return ret;
 }
 
 bool is_cmd_option(int argc, char *argv[], const char *str)
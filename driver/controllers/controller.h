@@ -23,6 +23,9 @@ struct controller_interface {
 	size_t (*read_data)(unsigned char *data, size_t length);
 	size_t (*write_data)(const unsigned char *data, size_t length);
 	size_t (*write_display_data)(const struct vfd_display_data *data);
+
+	unsigned char *(*get_framebuffer)(struct vfd_fb_info *info);
+	unsigned char (*flush_framebuffer)(const struct vfd_fb_rect *rect);
 };
 
 #endif
@@ -47,6 +47,7 @@ static struct controller_interface fd628_interface = {
 };
 
 size_t seg7_write_display_data(const struct vfd_display_data *data, unsigned short *raw_wdata, size_t sz);
+void seg7_set_led_codes(const led_bitmap *codes, unsigned int len);
 
 static struct vfd_dev *dev = NULL;
 static struct protocol_interface *protocol = NULL;
@@ -54,7 +55,6 @@ static unsigned char ram_grid_size = 2;
 static unsigned char ram_grid_count = 7;
 static unsigned char ram_size = 14;
 static struct vfd_display_data vfd_display_data;
-extern const led_bitmap *ledCodes;
 extern unsigned char ledDot;
 
 struct controller_interface *init_fd628(struct vfd_dev *_dev)
@@ -85,16 +85,16 @@ static unsigned char fd628_init(void)
 
 	switch(dev->dtb_active.display.type) {
 		case DISPLAY_TYPE_5D_7S_T95:
-			ledCodes = LED_decode_tab1;
+			seg7_set_led_codes(LED_decode_tab1, LED_DECODE_LEN(LED_decode_tab1));
 			break;
 		case DISPLAY_TYPE_5D_7S_G9SX:
-			ledCodes = LED_decode_tab3;
+			seg7_set_led_codes(LED_decode_tab3, LED_DECODE_LEN(LED_decode_tab3));
 			break;
 		case DISPLAY_TYPE_5D_7S_TAP1:
-			ledCodes = LED_decode_tab5;
+			seg7_set_led_codes(LED_decode_tab5, LED_DECODE_LEN(LED_decode_tab5));
 			break;
 		default:
-			ledCodes = LED_decode_tab2;
+			seg7_set_led_codes(LED_decode_tab2, LED_DECODE_LEN(LED_decode_tab2));
 			break;
 	}
 	switch (dev->dtb_active.display.controller) {
@@ -203,79 +203,79 @@ static void fd628_set_icon(const char *name, unsigned char state)
 	case DISPLAY_TYPE_5D_7S_G9SX:
 	default:
 		if (strncmp(name,"alarm",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT1_ALARM]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT1_ALARM]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT1_ALARM], state);
 		} else if (strncmp(name,"usb",3) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT1_USB]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT1_USB]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT1_USB], state);
 		} else if (strncmp(name,"play",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT1_PLAY]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT1_PLAY]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT1_PLAY], state);
 		} else if (strncmp(name,"pause",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT1_PAUSE]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT1_PAUSE]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT1_PAUSE], state);
 		} else if (strncmp(name,"colon",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT1_SEC]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT1_SEC]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT1_SEC], state);
 		} else if (strncmp(name,"eth",3) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT1_ETH]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT1_ETH]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT1_ETH], state);
 		} else if (strncmp(name,"wifi",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT1_WIFI]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT1_WIFI]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT1_WIFI], state);
 		}
 		break;
 	case DISPLAY_TYPE_5D_7S_X92:
 		if (strncmp(name,"apps",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT2_APPS]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT2_APPS]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT2_APPS], state);
 		} else if (strncmp(name,"setup",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT2_SETUP]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT2_SETUP]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT2_SETUP], state);
 		} else if (strncmp(name,"usb",3) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT2_USB]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT2_USB]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT2_USB], state);
 		} else if (strncmp(name,"sd",2) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT2_CARD]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT2_CARD]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT2_CARD], state);
 		} else if (strncmp(name,"colon",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT2_SEC]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT2_SEC]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT2_SEC], state);
 		} else if (strncmp(name,"hdmi",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT2_HDMI]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT2_HDMI]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT2_HDMI], state);
 		} else if (strncmp(name,"cvbs",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT2_CVBS]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT2_CVBS]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT2_CVBS], state);
 		}
 		break;
 	case DISPLAY_TYPE_5D_7S_ABOX:
 		if (strncmp(name,"power",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT3_POWER]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT3_POWER]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT3_POWER], state);
 		} else if (strncmp(name,"eth",3) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT3_LAN]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT3_LAN]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT3_LAN], state);
 		} else if (strncmp(name,"colon",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT3_SEC]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT3_SEC]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT3_SEC], state);
 		} else if (strncmp(name,"wifi",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT3_WIFIHI] | dtb->led_dots[LED_DOT3_WIFILO]) : (dev->status_led_mask & ~(dtb->led_dots[LED_DOT3_WIFIHI] | dtb->led_dots[LED_DOT3_WIFILO]));
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT3_WIFIHI] | dtb->led_dots[LED_DOT3_WIFILO], state);
 		}
 		break;
 	case DISPLAY_TYPE_5D_7S_M9_PRO:
 		if (strncmp(name,"b-t",3) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT4_BT]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT4_BT]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT4_BT], state);
 		} else if (strncmp(name,"eth",3) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT4_ETH]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT4_ETH]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT4_ETH], state);
 		} else if (strncmp(name,"wifi",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT4_WIFI]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT4_WIFI]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT4_WIFI], state);
 		} else if (strncmp(name,"spdif",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT4_SPDIF]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT4_SPDIF]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT4_SPDIF], state);
 		} else if (strncmp(name,"colon",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT4_SEC]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT4_SEC]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT4_SEC], state);
 		} else if (strncmp(name,"hdmi",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT4_HDMI]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT4_HDMI]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT4_HDMI], state);
 		} else if (strncmp(name,"cvbs",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT4_AV]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT4_AV]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT4_AV], state);
 		}
 		break;
 	case DISPLAY_TYPE_5D_X96_X9:
 		if (strncmp(name,"apps",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT5_APPS]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT5_APPS]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT5_APPS], state);
 		} else if (strncmp(name,"usb",3) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT5_USB]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT5_USB]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT5_USB], state);
 		} else if (strncmp(name,"sd",2) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT5_CARD]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT5_CARD]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT5_CARD], state);
 		} else if (strncmp(name,"colon",5) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT5_SEC]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT5_SEC]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT5_SEC], state);
 		} else if (strncmp(name,"eth",3) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT5_ETH]) : (dev->status_led_mask & ~dtb->led_dots[LED_DOT5_ETH]);
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT5_ETH], state);
 		} else if (strncmp(name,"wifi",4) == 0) {
-			dev->status_led_mask = state ? (dev->status_led_mask | dtb->led_dots[LED_DOT5_WIFIHI] | dtb->led_dots[LED_DOT5_WIFILO]) : (dev->status_led_mask & ~(dtb->led_dots[LED_DOT5_WIFIHI] | dtb->led_dots[LED_DOT5_WIFILO]));
+			vfd_set_status_led(dev, dtb->led_dots[LED_DOT5_WIFIHI] | dtb->led_dots[LED_DOT5_WIFILO], state);
 		}
 		break;
 	}
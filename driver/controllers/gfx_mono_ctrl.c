@@ -1,3 +1,5 @@
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include "gfx_mono_ctrl.h"
 #include "fonts/Grotesk16x32_h.h"
 #include "fonts/Grotesk16x32_v.h"
@@ -22,6 +24,8 @@ static void gfx_mono_ctrl_set_icon(const char *name, unsigned char state);
 static size_t gfx_mono_ctrl_read_data(unsigned char *data, size_t length);
 static size_t gfx_mono_ctrl_write_data(const unsigned char *data, size_t length);
 static size_t gfx_mono_ctrl_write_display_data(const struct vfd_display_data *data);
+static unsigned char *gfx_mono_ctrl_get_framebuffer(struct vfd_fb_info *info);
+static unsigned char gfx_mono_ctrl_flush_framebuffer(const struct vfd_fb_rect *rect);
 
 static struct controller_interface gfx_mono_ctrl_interface = {
 	.init = gfx_mono_ctrl_init,
@@ -38,6 +42,8 @@ static struct controller_interface gfx_mono_ctrl_interface = {
 	.read_data = gfx_mono_ctrl_read_data,
 	.write_data = gfx_mono_ctrl_write_data,
 	.write_display_data = gfx_mono_ctrl_write_display_data,
+	.get_framebuffer = gfx_mono_ctrl_get_framebuffer,
+	.flush_framebuffer = gfx_mono_ctrl_flush_framebuffer,
 };
 
 #define MAX_INDICATORS	4
@@ -114,6 +120,9 @@ static void print_title(const struct vfd_display_data *data);
 static void print_date(const struct vfd_display_data *data);
 static void print_temperature(const struct vfd_display_data *data);
 static void print_char(char ch, const struct font *font_struct, unsigned char x, unsigned char y);
+static void reset_frame_buffer(void);
+static void clear_screen(void);
+static void flush(void);
 
 static struct vfd_dev *dev = NULL;
 static unsigned char columns = 128;
@@ -126,6 +135,12 @@ static enum display_modes display_mode = DISPLAY_MODE_128x32;
 static unsigned char icon_x_offset = 0;
 static unsigned char indicators_on_screen[MAX_INDICATORS] = { 0 };
 static unsigned char ram_buffer[5000] = { 0 };
+#define FRAME_BUFFER_SIZE	PAGE_ALIGN(sizeof(ram_buffer))
+static unsigned char *frame_buffer = NULL;				// What the display should show, in controller RAM layout. vmalloc_user() memory for mmap().
+static unsigned char shadow_buffer[sizeof(ram_buffer)] = { 0 };		// What was last sent to the controller.
+static struct rect dirty_rect = { 0 };
+static unsigned char is_dirty = 0;
+static unsigned char is_flush_held = 0;
 static struct vfd_display_data old_data;
 static struct font font_text = { 0 };
 static struct font font_icons = { 0 };
@@ -152,31 +167,239 @@ struct controller_interface *init_gfx_mono_ctrl(struct vfd_dev *_dev, const stru
 		col_offset = gfx_mono_ctrl_display.offset << 1;
 	}
 	memset(&old_data, 0, sizeof(old_data));
+	if (!frame_buffer)
+		frame_buffer = vmalloc_user(FRAME_BUFFER_SIZE);
+	reset_frame_buffer();
 
 	setup_fonts();
-	if (specific_gfx_mono_ctrl.init)
+	// Without a frame buffer init() fails, and the driver falls back to the dummy controller.
+	if (!frame_buffer)
+		gfx_mono_ctrl_interface.init = gfx_mono_ctrl_init;
+	else if (specific_gfx_mono_ctrl.init)
 		gfx_mono_ctrl_interface.init = specific_gfx_mono_ctrl.init;
 	if (specific_gfx_mono_ctrl.set_display_type)
 		gfx_mono_ctrl_interface.set_display_type = specific_gfx_mono_ctrl.set_display_type;
-	if (!specific_gfx_mono_ctrl.print_char)
-		specific_gfx_mono_ctrl.print_char = print_char;
 	return &gfx_mono_ctrl_interface;
 }
 
+void release_gfx_mono_ctrl(void)
+{
+	vfree(frame_buffer);
+	frame_buffer = NULL;
+}
+
+/*
+ * All drawing goes into frame_buffer, laid out like the controller RAM:
+ * rows of 'columns' bytes, where a row is a bank (8 pixel lines) or, with
+ * swap_banks_orientation, a single pixel line. flush() sends whatever
+ * differs from shadow_buffer through specific_gfx_mono_ctrl.print_string.
+ */
+static void reset_frame_buffer(void)
+{
+	if (frame_buffer)
+		memset(frame_buffer, 0, FRAME_BUFFER_SIZE);
+	memset(shadow_buffer, 0, sizeof(shadow_buffer));
+	is_dirty = 0;
+}
+
+static void clear_screen(void)
+{
+	reset_frame_buffer();
+	specific_gfx_mono_ctrl.clear();
+}
+
+static void mark_dirty(unsigned short x1, unsigned short y1, unsigned short x2, unsigned short y2)
+{
+	if (!is_dirty) {
+		dirty_rect.x1 = x1;
+		dirty_rect.y1 = y1;
+		dirty_rect.x2 = x2;
+		dirty_rect.y2 = y2;
+		is_dirty = 1;
+	} else {
+		dirty_rect.x1 = min(dirty_rect.x1, x1);
+		dirty_rect.y1 = min(dirty_rect.y1, y1);
+		dirty_rect.x2 = max(dirty_rect.x2, x2);
+		dirty_rect.y2 = max(dirty_rect.y2, y2);
+	}
+}
+
+/*
+ * Controllers which can take a full frame burst only hold what was written
+ * to them, blanking the frame buffer then lets flush() send just the bytes
+ * the next screen changes, or the whole frame in one go.
+ */
+static void blank_screen(void)
+{
+	if (!specific_gfx_mono_ctrl.frame_cost) {
+		clear_screen();
+		return;
+	}
+	memset(frame_buffer, 0, FRAME_BUFFER_SIZE);
+	mark_dirty(0, 0, columns - 1, rows - 1);
+}
+
+static void blit(const unsigned char *buffer, const struct rect *rect)
+{
+	unsigned short width = rect->width, height = rect->height, i;
+	if (rect->x1 >= columns || rect->y1 >= rows || !width || !height)
+		return;
+	if (rect->x1 + width > columns)
+		width = columns - rect->x1;
+	if (rect->y1 + height > rows)
+		height = rows - rect->y1;
+	if ((rect->y1 + height) * columns > FRAME_BUFFER_SIZE)
+		return;
+
+	for (i = 0; i < height; i++)
+		memcpy(&frame_buffer[(rect->y1 + i) * columns + rect->x1], &buffer[i * rect->width], width);
+	mark_dirty(rect->x1, rect->y1, rect->x1 + width - 1, rect->y1 + height - 1);
+}
+
+static void flush_rect(struct rect *rect)
+{
+	unsigned short i, offset;
+	rect->width = rect->x2 - rect->x1 + 1;
+	rect->height = rect->y2 - rect->y1 + 1;
+	for (i = 0; i < rect->height; i++) {
+		offset = (rect->y1 + i) * columns + rect->x1;
+		memcpy(&ram_buffer[i * rect->width], &frame_buffer[offset], rect->width);
+		memcpy(&shadow_buffer[offset], &frame_buffer[offset], rect->width);
+	}
+	specific_gfx_mono_ctrl.print_string(ram_buffer, rect);
+}
+
+// Bytes we'd rather resend than open another address window for.
+#define FLUSH_MERGE_SLACK	16
+
+/*
+ * Sends the changed spans of the dirty rows, adjacent spans are merged into
+ * one window. With dry_run nothing is sent, only the bus cost of the windows
+ * is returned.
+ */
+static unsigned int flush_spans(unsigned short step, unsigned char dry_run)
+{
+	struct rect rect = { 0 };
+	unsigned short x1, x2, y, i, rect_bytes = 0;
+	unsigned int cost = 0;
+	unsigned char has_rect = 0;
+
+	for (y = dirty_rect.y1; y <= dirty_rect.y2; y += step) {
+		unsigned short y2 = min((unsigned short)(y + step - 1), (unsigned short)(rows - 1));
+		x1 = dirty_rect.x2 + 1;
+		x2 = 0;
+		for (i = y; i <= y2; i++) {
+			const unsigned char *fb = &frame_buffer[i * columns], *sb = &shadow_buffer[i * columns];
+			unsigned short lo = dirty_rect.x1, hi = dirty_rect.x2;
+			while (lo <= hi && fb[lo] == sb[lo])
+				lo++;
+			if (lo > hi)
+				continue;
+			while (fb[hi] == sb[hi])
+				hi--;
+			x1 = min(x1, lo);
+			x2 = max(x2, hi);
+		}
+		if (x1 > x2)
+			continue;
+
+		if (has_rect && y == rect.y2 + 1) {
+			unsigned short mx1 = min(rect.x1, x1), mx2 = max(rect.x2, x2);
+			unsigned short span_bytes = (x2 - x1 + 1) * (y2 - y + 1);
+			if ((mx2 - mx1 + 1) * (y2 - rect.y1 + 1) <= rect_bytes + span_bytes + FLUSH_MERGE_SLACK) {
+				rect.x1 = mx1;
+				rect.x2 = mx2;
+				rect.y2 = y2;
+				rect_bytes = (mx2 - mx1 + 1) * (y2 - rect.y1 + 1);
+				continue;
+			}
+		}
+		if (has_rect) {
+			cost += specific_gfx_mono_ctrl.window_cost + rect_bytes;
+			if (!dry_run)
+				flush_rect(&rect);
+		}
+		memset(&rect, 0, sizeof(rect));
+		rect.x1 = x1;
+		rect.x2 = x2;
+		rect.y1 = y;
+		rect.y2 = y2;
+		rect_bytes = (x2 - x1 + 1) * (y2 - y + 1);
+		has_rect = 1;
+	}
+	if (has_rect) {
+		cost += specific_gfx_mono_ctrl.window_cost + rect_bytes;
+		if (!dry_run)
+			flush_rect(&rect);
+	}
+	return cost;
+}
+
+static void flush(void)
+{
+	// Swapped banks are transposed in 8x8 blocks, keep the spans aligned to them.
+	const unsigned short step = swap_banks_orientation ? 8 : 1;
+	const unsigned int frame_cost = specific_gfx_mono_ctrl.frame_cost + columns * rows;
+	unsigned int dirty_cost;
+	if (!is_dirty || !dev->power || is_flush_held)
+		return;
+
+	dirty_rect.y1 -= dirty_rect.y1 % step;
+	// Worst case of the windows, only if that can exceed the frame it is worth looking closer.
+	dirty_cost = (dirty_rect.x2 - dirty_rect.x1 + 1) * (dirty_rect.y2 - dirty_rect.y1 + 1) +
+		DIV_ROUND_UP(dirty_rect.y2 - dirty_rect.y1 + 1, step) * specific_gfx_mono_ctrl.window_cost;
+	if (specific_gfx_mono_ctrl.frame_cost && dirty_cost > frame_cost && flush_spans(step, 1) > frame_cost) {
+		struct rect rect = { .x1 = 0, .y1 = 0, .x2 = columns - 1, .y2 = rows - 1 };
+		flush_rect(&rect);
+	} else {
+		flush_spans(step, 0);
+	}
+	is_dirty = 0;
+}
+
+static unsigned char *gfx_mono_ctrl_get_framebuffer(struct vfd_fb_info *info)
+{
+	memset(info, 0, sizeof(*info));
+	info->line_length = columns;
+	info->rows = rows;
+	info->width = swap_banks_orientation ? columns * 8 : columns;
+	info->height = swap_banks_orientation ? rows : rows * 8;
+	info->format = swap_banks_orientation ? VFD_FB_FORMAT_HMSB : VFD_FB_FORMAT_VLSB;
+	info->size = PAGE_ALIGN(columns * rows);
+	return frame_buffer;
+}
+
+static unsigned char gfx_mono_ctrl_flush_framebuffer(const struct vfd_fb_rect *rect)
+{
+	unsigned int x1 = rect->x, y1 = rect->y;
+	unsigned int x2 = x1 + rect->width - 1, y2 = y1 + rect->height - 1;
+	if (!rect->width || !rect->height)
+		return 0;
+	if (swap_banks_orientation) {
+		x1 /= 8;
+		x2 /= 8;
+	} else {
+		y1 /= 8;
+		y2 /= 8;
+	}
+	if (x1 >= columns || y1 >= rows)
+		return 0;
+
+	mark_dirty(x1, y1, min(x2, columns - 1U), min(y2, rows - 1U));
+	flush();
+	return 1;
+}
+
 static void print_char(char ch, const struct font *font_struct, unsigned char x, unsigned char y)
 {
-	unsigned short offset = 0, i;
+	struct rect rect = {
+		.x1 = x, .y1 = y, .width = font_struct->font_width, .height = font_struct->font_height,
+	};
 	if (x >= columns || y >= rows || ch < font_struct->font_offset || ch >= font_struct->font_offset + font_struct->font_char_count)
 		return;
 
 	ch -= font_struct->font_offset;
-	offset = ch * font_struct->font_char_size;
-	offset += 4;
-	for (i = 0; i < font_struct->font_height; i++) {
-		specific_gfx_mono_ctrl.set_xy(x, y + i);
-		specific_gfx_mono_ctrl.write_ctrl_data_buf(&font_struct->font_bitmaps[offset], font_struct->font_width);
-		offset += font_struct->font_width;
-	}
+	blit(&font_struct->font_bitmaps[ch * font_struct->font_char_size + 4], &rect);
 }
 
 extern void transpose8rS64(unsigned char* A, unsigned char* B);
@@ -304,7 +527,7 @@ static void print_string(const char *str, const struct font *font_struct, unsign
 		transpose_buffer(ram_buffer, &rect);
 	else
 		print_buffer(ram_buffer, &rect, 0);
-	specific_gfx_mono_ctrl.print_string(ram_buffer, &rect);
+	blit(ram_buffer, &rect);
 }
 
 static unsigned char prepare_and_print_string(const char *str, const struct font *font_struct, unsigned char x, unsigned char y)
@@ -397,7 +620,10 @@ static void setup_fonts(void)
 
 static unsigned char gfx_mono_ctrl_init(void)
 {
+	if (!frame_buffer)
+		return 0;
 	old_data.mode = DISPLAY_MODE_NONE;
+	reset_frame_buffer();
 	if (gfx_mono_ctrl_interface.init != gfx_mono_ctrl_init)
 		return gfx_mono_ctrl_interface.init();
 	return 0;
@@ -474,7 +700,7 @@ static void gfx_mono_ctrl_set_icon(const char *name, unsigned char state)
 		icon = INDICATOR_ICON_SETUP;
 		indicators.setup = state;
 	} else if (strncmp(name,"colon",5) == 0) {
-		dev->status_led_mask = state ? (dev->status_led_mask | ledDots[LED_DOT_SEC]) : (dev->status_led_mask & ~ledDots[LED_DOT_SEC]);
+		vfd_set_status_led(dev, ledDots[LED_DOT_SEC], state);
 	}
 
 	switch (icon) {
@@ -523,6 +749,7 @@ static void gfx_mono_ctrl_set_icon(const char *name, unsigned char state)
 	default:
 		break;
 	}
+	flush();
 }
 
 static size_t gfx_mono_ctrl_read_data(unsigned char *data, size_t length)
@@ -542,7 +769,9 @@ static size_t gfx_mono_ctrl_write_display_data(const struct vfd_display_data *da
 		unsigned char i;
 		icon_x_offset = 0;
 		memset(&old_data, 0, sizeof(old_data));
-		specific_gfx_mono_ctrl.clear();
+		blank_screen();
+		// The new screen is sent as a whole by the flush() below.
+		is_flush_held = 1;
 		switch (data->mode) {
 		case DISPLAY_MODE_CLOCK:
 			old_data.mode = DISPLAY_MODE_CLOCK;
@@ -598,6 +827,8 @@ static size_t gfx_mono_ctrl_write_display_data(const struct vfd_display_data *da
 		break;
 	}
 
+	is_flush_held = 0;
+	flush();
 	old_data = *data;
 	return status;
 }
@@ -720,7 +951,7 @@ static void print_clock(const struct vfd_display_data *data, unsigned char print
 		}
 		if (colon_on != old_data.colon_on && show_colon) {
 			unsigned char offset = (columns - font_text.font_width) / 2;
-			specific_gfx_mono_ctrl.print_char(colon_on ? ':' : ' ', &font_text, offset, rows - font_text.font_height);
+			print_char(colon_on ? ':' : ' ', &font_text, offset, rows - font_text.font_height);
 		}
 	} else if (!force_print) {
 		const int len = print_seconds ? 8 : 5;
@@ -732,7 +963,7 @@ static void print_clock(const struct vfd_display_data *data, unsigned char print
 		offset += 2 * font_text.font_width;
 		if (show_colon) {
 			if (colon_on != old_data.colon_on)
-				specific_gfx_mono_ctrl.print_char(colon_on ? ':' : ' ', &font_text, offset, 0);
+				print_char(colon_on ? ':' : ' ', &font_text, offset, 0);
 			offset += font_text.font_width;
 		}
 		if (data->time_date.minutes != old_data.time_date.minutes) {
@@ -742,7 +973,7 @@ static void print_clock(const struct vfd_display_data *data, unsigned char print
 		offset += 2 * font_text.font_width;
 		if (print_seconds) {
 			if (colon_on != old_data.colon_on)
-				specific_gfx_mono_ctrl.print_char(colon_on ? ':' : ' ', &font_text, offset, 0);
+				print_char(colon_on ? ':' : ' ', &font_text, offset, 0);
 			offset += font_text.font_width;
 			if (data->time_date.seconds != old_data.time_date.seconds) {
 				scnprintf(buffer, sizeof(buffer), "%02d", data->time_date.seconds);
@@ -797,10 +1028,10 @@ static void print_playback_time(const struct vfd_display_data *data)
 			}
 		}
 		if (show_colon)
-			specific_gfx_mono_ctrl.print_char(data->colon_on ? ':' : ' ', &font_text, offset + (font_text.font_height * 8), rows - font_text.font_height);
+			print_char(data->colon_on ? ':' : ' ', &font_text, offset + (font_text.font_height * 8), rows - font_text.font_height);
 	} else if (!force_print) {
 		if (data->colon_on != old_data.colon_on && show_colon) {
-			specific_gfx_mono_ctrl.print_char(data->colon_on ? ':' : ' ', &font_text, offset + (2 * font_text.font_width), 0);
+			print_char(data->colon_on ? ':' : ' ', &font_text, offset + (2 * font_text.font_width), 0);
 		}
 		if (data->time_date.hours > 0) {
 			if (data->time_date.hours != old_data.time_date.hours) {
@@ -880,7 +1111,7 @@ static void print_date(const struct vfd_display_data *data)
 			scnprintf(buffer, sizeof(buffer), "%02d", data->time_secondary._reserved ? data->time_date.day : data->time_date.month + 1);
 			print_string(buffer, &font_text, offset + show_colon * font_text.font_width + (font_text.font_height * 8), 0);
 			if (show_colon)
-				specific_gfx_mono_ctrl.print_char('|', &font_text, offset + font_text.font_height * 8, rows - font_text.font_height);
+				print_char('|', &font_text, offset + font_text.font_height * 8, rows - font_text.font_height);
 		} else {
 			unsigned char day, month;
 			if (data->time_secondary._reserved) {
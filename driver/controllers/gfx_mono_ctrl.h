@@ -42,7 +42,6 @@ struct specific_gfx_mono_ctrl
 	void (*set_power)(unsigned char state);
 	void (*set_contrast)(unsigned char value);
 	unsigned char (*set_xy)(unsigned short x, unsigned short y);
-	void (*print_char)(char ch, const struct font *font_struct, unsigned char x, unsigned char y);
 	void (*print_string)(const unsigned char *buffer, const struct rect *rect);
 
 	void (*write_ctrl_command_buf)(const unsigned char *buf, unsigned int length);
@@ -51,8 +50,14 @@ struct specific_gfx_mono_ctrl
 	void (*write_ctrl_data)(unsigned char data);
 
 	const struct screen_view *screen_view;
+
+	// Bus bytes spent addressing a window and the whole frame, flush() sends the
+	// whole frame at once when that is cheaper than the damaged windows (0 = never).
+	unsigned short window_cost;
+	unsigned short frame_cost;
 };
 
 struct controller_interface *init_gfx_mono_ctrl(struct vfd_dev *_dev, const struct specific_gfx_mono_ctrl *specific_gfx_mono_ctrl);
+void release_gfx_mono_ctrl(void);
 
 #endif
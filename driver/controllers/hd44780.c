@@ -287,7 +287,7 @@ static unsigned char hd47780_set_display_type(struct vfd_display *display)
 static void hd47780_set_icon(const char *name, unsigned char state)
 {
 	if (strncmp(name,"colon",5) == 0)
-		dev->status_led_mask = state ? (dev->status_led_mask | ledDots[LED_DOT_SEC]) : (dev->status_led_mask & ~ledDots[LED_DOT_SEC]);
+		vfd_set_status_led(dev, ledDots[LED_DOT_SEC], state);
 }
 
 static size_t hd47780_read_data(unsigned char *data, size_t length)
@@ -2,9 +2,13 @@
 #include <linux/list.h>
 #include <linux/jiffies.h>
 #include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
 #include "../protocols/i2c_hw.h"
 #include "../protocols/i2c_sw.h"
 #include "../protocols/spi_sw.h"
+#include "../protocols/spi_hw.h"
 #include "il3829.h"
 #include "gfx_mono_ctrl.h"
 
@@ -15,7 +19,6 @@ static void il3829_set_power(unsigned char state);
 static void il3829_set_contrast(unsigned char value);
 static unsigned char il3829_set_xy(unsigned short x, unsigned short y);
 static void il3829_set_area(const struct rect *rect);
-static void il3829_print_char(char ch, const struct font *font_struct, unsigned char x, unsigned char y);
 static void il3829_print_string(const unsigned char *buffer, const struct rect *rect);
 static void il3829_write_ctrl_command_data_buf(const unsigned char *buf, unsigned int length);
 static void il3829_write_ctrl_command(unsigned char cmd);
@@ -31,7 +34,6 @@ static struct specific_gfx_mono_ctrl il3829_gfx_mono_ctrl = {
 	.set_power = il3829_set_power,
 	.set_contrast = il3829_set_contrast,
 	.set_xy = il3829_set_xy,
-	.print_char = il3829_print_char,
 	.print_string = il3829_print_string,
 	.write_ctrl_command_buf = il3829_write_ctrl_command_data_buf,
 	.write_ctrl_command = il3829_write_ctrl_command,
@@ -74,19 +76,34 @@ struct il3829_display {
 	unsigned char controller;
 };
 
-struct write_list {
+struct damage_rect {
 	struct rect rect;
-	unsigned short buffer_length;
-	unsigned char *buffer;
 	struct list_head list;
 };
 
 static void il3829_init_display(unsigned char is_full_mode);
+static void init_damage_pool(void);
+static void stop_refresh_thread(void);
+static void start_refresh_thread(void);
 
 #define GxGDEP015OC1_POWER_DELAY 150
 #define GxGDEP015OC1_PU_DELAY 325
 #define GxGDEP015OC1_FU_DELAY 1300
 
+#define IL3829_FRAME_SIZE (200 * 200 / 8)
+// Bytes of the 0x44, 0x45, 0x4E, 0x4F and 0x24 commands opening a RAM window.
+#define IL3829_WINDOW_COST 14
+// Pending damage is bounded, once all regions are taken new ones are folded into the nearest.
+#define IL3829_MAX_DAMAGE 32
+// The refresh period halves while updates keep coming and doubles while idle.
+#define IL3829_PERIOD_MIN 100
+#define IL3829_PERIOD_MAX 1000
+// Idle time after which a half spent ghosting budget is cleaned up by a full refresh.
+#define IL3829_QUIET_MS 5000
+// Default ghosting budget: partial updates, and their area in % of the screen, between full refreshes.
+#define IL3829_FULL_REFRESH_COUNT 50
+#define IL3829_FULL_REFRESH_AREA 1000
+
 const unsigned char LUTDefault_full[] =
 {
   0x32,  // command
@@ -106,14 +123,39 @@ static struct protocol_interface *protocol;
 static unsigned short rows = 200;
 static unsigned short banks = 200 / 8;
 static unsigned char row_offset = 0;
-static const unsigned char ram_buffer_blank[] = { [0 ... ((200 * 200 / 8) - 1)] = 0xFF };
+static unsigned char device_frame[IL3829_FRAME_SIZE];		// What the panel should show, in panel RAM layout and polarity.
+static unsigned char xfer_buffer[IL3829_FRAME_SIZE];
+static unsigned char refresh_buffer[IL3829_FRAME_SIZE];		// Pixels of refresh_rects, packed in order.
 static const unsigned char is_full_mode = 1;
 static int pin_rst = -1;
 static int pin_dc = -1;
 static int pin_busy = -1;
+static int busy_irq = -1;
+static DECLARE_COMPLETION(busy_done);
+static DEFINE_MUTEX(bus_mutex);
+// Guards device_frame, the damage and the refresh state, the refresh thread takes nothing else of the driver.
+static DEFINE_MUTEX(damage_mutex);
 static struct il3829_display il3829_display;
-static struct write_list write_list;
+static struct damage_rect damage_pool[IL3829_MAX_DAMAGE];
+static LIST_HEAD(damage_list);
+static LIST_HEAD(free_list);
+static struct rect refresh_rects[IL3829_MAX_DAMAGE];
+static unsigned char refresh_count = 0;
 static unsigned char power_state = 0;
+static unsigned char is_full_requested = 0;
+struct task_struct *refresh_thread = NULL;
+static unsigned int refresh_period = IL3829_PERIOD_MAX;
+static unsigned long last_damage = 0;
+static unsigned int partial_count = 0;
+static unsigned int partial_area = 0;
+static unsigned int full_refresh_count = IL3829_FULL_REFRESH_COUNT;
+static unsigned int full_refresh_area = IL3829_FULL_REFRESH_AREA;
+
+void il3829_set_full_refresh(unsigned int count, unsigned int area)
+{
+	full_refresh_count = count ? count : IL3829_FULL_REFRESH_COUNT;
+	full_refresh_area = area ? area : IL3829_FULL_REFRESH_AREA;
+}
 
 static unsigned char is_needs_transpose(void)
 {
@@ -122,8 +164,11 @@ static unsigned char is_needs_transpose(void)
 
 struct controller_interface *init_il3829(struct vfd_dev *_dev)
 {
+	unsigned char is_running = refresh_thread != NULL;
 	dev = _dev;
-	INIT_LIST_HEAD(&write_list.list);
+	// The refresh thread works on the geometry below, park it while that changes.
+	stop_refresh_thread();
+	init_damage_pool();
 	memcpy(&il3829_display, &dev->dtb_active.display, sizeof(il3829_display));
 	switch (il3829_display.spi.disp_type) {
 	case TYPE_IL3820:
@@ -144,6 +189,8 @@ struct controller_interface *init_il3829(struct vfd_dev *_dev)
 	}
 	screen_view.colomn_offset = 0;
 	screen_view.swap_banks_orientation = 1;
+	if (is_running)
+		start_refresh_thread();
 	return init_gfx_mono_ctrl(_dev, &il3829_gfx_mono_ctrl);
 }
 
@@ -179,14 +226,49 @@ static void il3829_write_ctrl_data(unsigned char data)
 	il3829_write_ctrl_buf(0x40, &data, 1);
 }
 
+static irqreturn_t il3829_busy_isr(int irq, void *data)
+{
+	complete(&busy_done);
+	return IRQ_HANDLED;
+}
+
+static void request_busy_irq(void)
+{
+	int irq;
+	if (pin_busy < 0 || busy_irq >= 0)
+		return;
+	irq = gpio_to_irq(pin_busy);
+	if (irq < 0 || request_irq(irq, il3829_busy_isr, IRQF_TRIGGER_FALLING, DEV_NAME "_busy", NULL)) {
+		pr_dbg2("IL3829: no interrupt on the BUSY pin (%d), polling it\n", pin_busy);
+		return;
+	}
+	busy_irq = irq;
+}
+
+static void free_busy_irq(void)
+{
+	if (busy_irq >= 0) {
+		free_irq(busy_irq, NULL);
+		busy_irq = -1;
+	}
+}
+
+// Runs the update sequence selected with command 0x22, BUSY drops once it is done.
+static void il3829_master_activation(void)
+{
+	if (busy_irq >= 0)
+		reinit_completion(&busy_done);
+	il3829_write_ctrl_command(0x20);
+}
+
 static void il3829_wait_busy(unsigned short max_delay)
 {
-	if (pin_busy >= 0) {
-		unsigned short delay_count = 0;
-		while (delay_count < max_delay && gpio_get_value(pin_busy)) {
-			msleep(10);
-			delay_count += 10;
-		}
+	if (busy_irq >= 0) {
+		wait_for_completion_timeout(&busy_done, msecs_to_jiffies(max_delay));
+	} else if (pin_busy >= 0) {
+		unsigned long timeout = jiffies + msecs_to_jiffies(max_delay);
+		while (gpio_get_value(pin_busy) && time_before(jiffies, timeout))
+			usleep_range(1000, 2000);
 	} else {
 		msleep(max_delay);
 	}
@@ -196,7 +278,7 @@ static void il3829_full_update(void)
 {
 	il3829_write_ctrl_command(0x22);
 	il3829_write_ctrl_data(0xC4);
-	il3829_write_ctrl_command(0x20);
+	il3829_master_activation();
 	il3829_write_ctrl_command(0xFF);
 	il3829_wait_busy(GxGDEP015OC1_FU_DELAY);
 }
@@ -205,7 +287,7 @@ static void il3829_part_update(void)
 {
 	il3829_write_ctrl_command(0x22);
 	il3829_write_ctrl_data(0x04);
-	il3829_write_ctrl_command(0x20);
+	il3829_master_activation();
 	il3829_write_ctrl_command(0xFF);
 	il3829_wait_busy(GxGDEP015OC1_PU_DELAY);
 }
@@ -218,37 +300,236 @@ inline static void il3829_update(unsigned char is_full_mode)
 		il3829_part_update();
 }
 
-struct task_struct *refresh_thread = NULL;
+static unsigned int rect_area(const struct rect *rect)
+{
+	return (rect->x2 - rect->x1 + 1) * (rect->y2 - rect->y1 + 1);
+}
+
+static void bounding_rect(struct rect *box, const struct rect *a, const struct rect *b)
+{
+	box->x1 = min(a->x1, b->x1);
+	box->y1 = min(a->y1, b->y1);
+	box->x2 = max(a->x2, b->x2);
+	box->y2 = max(a->y2, b->y2);
+}
+
+static void clear_damage_list(void)
+{
+	list_splice_init(&damage_list, &free_list);
+}
+
+/*
+ * Folds damaged regions together while the bounding box costs no more bus
+ * bytes than sending them apart, which takes care of overlapping regions and
+ * of neighbours whose window setup outweighs the few undamaged bytes between.
+ */
+static void merge_damage(void)
+{
+	struct damage_rect *a, *b, *tmp;
+	unsigned char is_merged;
+	do {
+		is_merged = 0;
+		list_for_each_entry(a, &damage_list, list) {
+			b = list_next_entry(a, list);
+			list_for_each_entry_safe_from(b, tmp, &damage_list, list) {
+				struct rect box;
+				bounding_rect(&box, &a->rect, &b->rect);
+				if (rect_area(&box) <= rect_area(&a->rect) + rect_area(&b->rect) + IL3829_WINDOW_COST) {
+					a->rect = box;
+					list_del(&b->list);
+					list_add(&b->list, &free_list);
+					is_merged = 1;
+				}
+			}
+		}
+	} while (is_merged);
+}
+
+static void add_damage(const struct rect *rect)
+{
+	struct damage_rect *item, *nearest = NULL;
+	struct rect box, nearest_box;
+	unsigned int growth, nearest_growth = ~0U;
+
+	last_damage = jiffies;
+	if (list_empty(&free_list))
+		merge_damage();
+	if (!list_empty(&free_list)) {
+		item = list_first_entry(&free_list, struct damage_rect, list);
+		item->rect = *rect;
+		list_del(&item->list);
+		list_add_tail(&item->list, &damage_list);
+		return;
+	}
+
+	// Still full, grow the region that gains the least area by covering this one too.
+	list_for_each_entry(item, &damage_list, list) {
+		bounding_rect(&box, &item->rect, rect);
+		growth = rect_area(&box) - rect_area(&item->rect);
+		if (growth < nearest_growth) {
+			nearest = item;
+			nearest_box = box;
+			nearest_growth = growth;
+		}
+	}
+	nearest->rect = nearest_box;
+}
+
+// Set up once, the regions only move between the two lists after that.
+static void init_damage_pool(void)
+{
+	static unsigned char is_initialized = 0;
+	unsigned char i;
+	if (is_initialized)
+		return;
+	is_initialized = 1;
+	INIT_LIST_HEAD(&damage_list);
+	INIT_LIST_HEAD(&free_list);
+	for (i = 0; i < IL3829_MAX_DAMAGE; i++)
+		list_add_tail(&damage_pool[i].list, &free_list);
+}
+
+static void write_region(const struct rect *rect, const unsigned char *data)
+{
+	il3829_set_area(rect);
+	il3829_set_xy(rect->x1, rect->y1);
+	il3829_write_ctrl_command(0x24);
+	il3829_write_ctrl_data_buf(data, rect_area(rect));
+}
+
+// Share of the ghosting budget spent by the partial updates since the last full refresh, in %.
+static unsigned int ghosting_level(void)
+{
+	unsigned int count_level = partial_count * 100 / full_refresh_count;
+	unsigned int area_level = partial_area * 100 / (full_refresh_area * banks * rows / 100);
+	return max(count_level, area_level);
+}
+
+enum refresh_types {
+	REFRESH_NONE,
+	REFRESH_PARTIAL,
+	REFRESH_FULL,
+};
+
+/*
+ * Partial updates are sent as damage comes in, the period follows the update
+ * rate. Once the partial updates have spent the ghosting budget, or have spent
+ * half of it and the screen went quiet, the whole frame is redrawn with the
+ * full waveform. A mode change asks for that right away.
+ */
+static unsigned char select_refresh(void)
+{
+	if (is_full_requested || (!list_empty(&damage_list) && ghosting_level() >= 100)) {
+		refresh_period = IL3829_PERIOD_MIN;
+		return REFRESH_FULL;
+	} else if (!list_empty(&damage_list)) {
+		refresh_period = max(refresh_period / 2, (unsigned int)IL3829_PERIOD_MIN);
+		return REFRESH_PARTIAL;
+	} else {
+		refresh_period = min(refresh_period * 2, (unsigned int)IL3829_PERIOD_MAX);
+		if (partial_count && ghosting_level() >= 50 && time_after(jiffies, last_damage + msecs_to_jiffies(IL3829_QUIET_MS)))
+			return REFRESH_FULL;
+	}
+	return REFRESH_NONE;
+}
+
+/*
+ * Called with damage_mutex held, takes the damaged regions and a copy of their
+ * pixels over to the refresh thread so the panel can be driven without it.
+ */
+static unsigned char prepare_refresh(void)
+{
+	struct damage_rect *item;
+	unsigned int offset = 0;
+	unsigned short y;
+	unsigned char i, type = select_refresh();
+
+	if (type == REFRESH_PARTIAL) {
+		merge_damage();
+		refresh_count = 0;
+		list_for_each_entry(item, &damage_list, list) {
+			refresh_rects[refresh_count++] = item->rect;
+			offset += rect_area(&item->rect);
+		}
+		clear_damage_list();
+		// Regions that add up to more than a frame are cheaper sent as one.
+		if (offset > banks * rows) {
+			refresh_rects[0].x1 = refresh_rects[0].y1 = 0;
+			refresh_rects[0].x2 = banks - 1;
+			refresh_rects[0].y2 = rows - 1;
+			refresh_count = 1;
+		}
+		offset = 0;
+		for (i = 0; i < refresh_count; i++) {
+			const struct rect *rect = &refresh_rects[i];
+			unsigned short width = rect->x2 - rect->x1 + 1;
+			for (y = rect->y1; y <= rect->y2; y++, offset += width)
+				memcpy(&refresh_buffer[offset], &device_frame[y * banks + rect->x1], width);
+			partial_area += rect_area(rect);
+		}
+		partial_count++;
+	} else if (type == REFRESH_FULL) {
+		clear_damage_list();
+		memcpy(refresh_buffer, device_frame, banks * rows);
+		partial_count = 0;
+		partial_area = 0;
+		is_full_requested = 0;
+	}
+	return type;
+}
+
+// Called with bus_mutex held only, the update waits for BUSY while the rest of the driver carries on.
+static void run_refresh(unsigned char type)
+{
+	unsigned int offset = 0;
+	unsigned char i;
+
+	if (type == REFRESH_FULL) {
+		struct rect full_rect = {
+			.x1 = 0x00, .x2 = banks - 1, .y1 = 0x00, .y2 = rows - 1
+		};
+		il3829_init_display(is_full_mode);
+		write_region(&full_rect, refresh_buffer);
+		il3829_update(is_full_mode);
+		write_region(&full_rect, refresh_buffer);
+		il3829_init_display(!is_full_mode);
+		return;
+	}
+
+	for (i = 0; i < refresh_count; i++) {
+		write_region(&refresh_rects[i], &refresh_buffer[offset]);
+		offset += rect_area(&refresh_rects[i]);
+	}
+	il3829_update(!is_full_mode);
+	// The partial update waveform drives from both RAM banks, write the regions again once it is done.
+	offset = 0;
+	for (i = 0; i < refresh_count; i++) {
+		write_region(&refresh_rects[i], &refresh_buffer[offset]);
+		offset += rect_area(&refresh_rects[i]);
+	}
+}
 
 static int refresh_thread_loop(void *data)
 {
 	unsigned int prev_msecs, delay;
+	unsigned char type;
 	while (!kthread_should_stop())
 	{
-		if (!mutex_trylock(dev->mutex)) {
-			msleep(1);
-			continue;
-		}
 		prev_msecs = jiffies_to_msecs(jiffies);
-		if (power_state) {
-			if (!list_empty(&write_list.list)) {
-				struct write_list *item, *tmp;
-				il3829_update(!is_full_mode);
-				list_for_each_entry_safe(item, tmp, &write_list.list, list) {
-					il3829_set_area(&item->rect);
-					il3829_set_xy(item->rect.x1, item->rect.y1);
-					il3829_write_ctrl_command(0x24);
-					il3829_write_ctrl_data_buf(item->buffer, item->buffer_length);
-					list_del(&item->list);
-					kfree(item->buffer);
-					kfree(item);
-				}
-			}
+		mutex_lock(&damage_mutex);
+		type = power_state ? prepare_refresh() : REFRESH_NONE;
+		mutex_unlock(&damage_mutex);
+		if (type != REFRESH_NONE) {
+			mutex_lock(&bus_mutex);
+			run_refresh(type);
+			mutex_unlock(&bus_mutex);
 		}
-		delay = min((unsigned int)500, (jiffies_to_msecs(jiffies) - prev_msecs));
-		mutex_unlock(dev->mutex);
-		if (!kthread_should_stop())
-			msleep(500 - delay);
+		delay = min(refresh_period, (jiffies_to_msecs(jiffies) - prev_msecs));
+		// Set before the checks, so a wake_up_process() in between is not lost.
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!kthread_should_stop() && !is_full_requested)
+			schedule_timeout(msecs_to_jiffies(refresh_period - delay));
+		__set_current_state(TASK_RUNNING);
 	}
 
 	return 0;
@@ -260,6 +541,7 @@ static void stop_refresh_thread(void)
 	{
 		kthread_stop(refresh_thread);
 		refresh_thread = NULL;
+		free_busy_irq();
 	}
 }
 
@@ -267,21 +549,12 @@ static void start_refresh_thread(void)
 {
 	if (!refresh_thread)
 	{
+		request_busy_irq();
 		refresh_thread = kthread_create(refresh_thread_loop, NULL, "%s_e-ink_refresh_thread_loop", DEV_NAME);
 		wake_up_process(refresh_thread);
 	}
 }
 
-static void clear_write_list(void)
-{
-	struct write_list *item, *tmp;
-	list_for_each_entry_safe(item, tmp, &write_list.list, list) {
-		list_del(&item->list);
-		kfree(item->buffer);
-		kfree(item);
-	}
-}
-
 static void clear(unsigned char is_full_mode)
 {
 	struct rect full_rect = {
@@ -290,13 +563,23 @@ static void clear(unsigned char is_full_mode)
 	il3829_set_area(&full_rect);
 	il3829_set_xy(0, 0);
 	il3829_write_ctrl_command(0x24);
-	il3829_write_ctrl_data_buf(ram_buffer_blank, sizeof(ram_buffer_blank));
+	il3829_write_ctrl_data_buf(device_frame, banks * rows);
 	il3829_update(is_full_mode);
 }
 
 static void il3829_clear(void)
 {
-	clear_write_list();
+	mutex_lock(&damage_mutex);
+	clear_damage_list();
+	memset(device_frame, 0xFF, sizeof(device_frame));
+	if (refresh_thread) {
+		// Redrawn by the refresh thread with whatever is drawn next, without stalling the caller.
+		is_full_requested = 1;
+		mutex_unlock(&damage_mutex);
+		wake_up_process(refresh_thread);
+		return;
+	}
+	mutex_unlock(&damage_mutex);
 	il3829_init_display(is_full_mode);
 	clear(is_full_mode);
 	clear(is_full_mode);
@@ -305,21 +588,29 @@ static void il3829_clear(void)
 
 static void il3829_set_power(unsigned char state)
 {
+	mutex_lock(&damage_mutex);
 	power_state = state;
+	if (!state)
+		clear_damage_list();
+	mutex_unlock(&damage_mutex);
+	// Stopped holding none of the locks the thread takes, it finishes its pass and exits.
+	if (!state)
+		stop_refresh_thread();
+	mutex_lock(&bus_mutex);
 	if (state) {
-		start_refresh_thread();
 		il3829_init_display(!is_full_mode);
 	} else {
-		stop_refresh_thread();
 		il3829_init_display(is_full_mode);
 		il3829_update(is_full_mode);
-		clear_write_list();
 	}
 
 	il3829_write_ctrl_command(0x22);
 	il3829_write_ctrl_data(state ? 0xC0 : 0xC3);
-	il3829_write_ctrl_command(0x20);
+	il3829_master_activation();
 	il3829_wait_busy(GxGDEP015OC1_POWER_DELAY);
+	mutex_unlock(&bus_mutex);
+	if (state)
+		start_refresh_thread();
 }
 
 static void il3829_set_contrast(unsigned char value)
@@ -349,29 +640,11 @@ static void il3829_set_area(const struct rect *rect)
 	il3829_write_ctrl_command_data_buf(y_buf, sizeof(y_buf));
 }
 
-static void il3829_print_char(char ch, const struct font *font_struct, unsigned char x, unsigned char y)
-{
-	unsigned short offset = 0;
-	struct rect rect = {
-		.x1 = x, .x2 = x + font_struct->font_width - 1, .y1 = y, .y2 = y + font_struct->font_height - 1,
-		.font = font_struct, .length = 1, .width = font_struct->font_width, .height = font_struct->font_height,
-	};
-	if (is_needs_transpose())
-		swap(x, y);
-	if (x >= banks || y >= rows || ch < font_struct->font_offset || ch >= font_struct->font_offset + font_struct->font_char_count)
-		return;
-
-	ch -= font_struct->font_offset;
-	offset = ch * font_struct->font_char_size;
-	offset += 4;
-	il3829_print_string(&font_struct->font_bitmaps[offset], &rect);
-}
-
-static inline void il3829_adjust_buffer(const struct write_list *item)
+static inline void il3829_adjust_buffer(unsigned char *buffer, unsigned short length)
 {
 	unsigned short i;
-	for (i = 0; i < item->buffer_length; i++)
-		item->buffer[i] = ~item->buffer[i];
+	for (i = 0; i < length; i++)
+		buffer[i] = ~buffer[i];
 }
 
 static void transpose_rect(struct rect *rect)
@@ -380,7 +653,7 @@ static void transpose_rect(struct rect *rect)
 	rect->x1 = (tmp.y1 / 8);
 	rect->x2 = (tmp.y2 / 8);
 	rect->y1 = rows - 8 - (tmp.x2 * 8);
-	rect->y2 = rows - (tmp.x1 * 8);
+	rect->y2 = rows - 1 - (tmp.x1 * 8);
 	rect->width = tmp.height / 8;
 	rect->height = tmp.width * 8;
 }
@@ -388,33 +661,26 @@ static void transpose_rect(struct rect *rect)
 extern void transpose_buffer(unsigned char *buffer, const struct rect *rect);
 static void il3829_print_string(const unsigned char *buffer, const struct rect *_rect)
 {
-	struct write_list *new_write;
+	struct rect rect = *_rect;
+	unsigned short length = rect.width * rect.height, y;
 
-	if (!power_state)
+	if (!power_state || !length || length > sizeof(xfer_buffer))
 		return;
 
-	new_write = kmalloc(sizeof(*new_write), GFP_KERNEL);
-	if (new_write) {
-		new_write->rect = *_rect;
-		new_write->buffer_length = _rect->length * _rect->font->font_char_size;
-		new_write->buffer = kmalloc(new_write->buffer_length, GFP_KERNEL);
-		if (new_write->buffer) {
-			list_add_tail(&new_write->list, &write_list.list);
-			memcpy(new_write->buffer, buffer, new_write->buffer_length);
-			il3829_adjust_buffer(new_write);
-
-			if (is_needs_transpose()) {
-				transpose_buffer(new_write->buffer, &new_write->rect);
-				transpose_rect(&new_write->rect);
-			}
-			il3829_set_area(&new_write->rect);
-			il3829_set_xy(new_write->rect.x1, new_write->rect.y1);
-			il3829_write_ctrl_command(0x24);
-			il3829_write_ctrl_data_buf(new_write->buffer, new_write->buffer_length);
-		} else {
-			kfree(new_write);
-		}
+	memcpy(xfer_buffer, buffer, length);
+	il3829_adjust_buffer(xfer_buffer, length);
+	if (is_needs_transpose()) {
+		transpose_buffer(xfer_buffer, &rect);
+		transpose_rect(&rect);
 	}
+	if (rect.x2 >= banks || rect.y2 >= rows)
+		return;
+
+	mutex_lock(&damage_mutex);
+	for (y = 0; y < rect.height; y++)
+		memcpy(&device_frame[(rect.y1 + y) * banks + rect.x1], &xfer_buffer[y * rect.width], rect.width);
+	add_damage(&rect);
+	mutex_unlock(&damage_mutex);
 }
 
 static void il3829_init_display(unsigned char is_full_mode)
@@ -464,11 +730,14 @@ static void il3829_init_display(unsigned char is_full_mode)
 		il3829_write_ctrl_command_data_buf(LUTDefault_part, sizeof(LUTDefault_part));
 }
 
-static unsigned char il3829_init(void)
+static unsigned char il3829_init_bus(void)
 {
 	if (il3829_display.spi.is_spi) {
 		if (dev->gpio1_pin.pin >= 0) {
-			protocol = init_sw_spi_3w(MSB_FIRST, dev->clk_pin, dev->dat_pin, dev->stb_pin, il3829_display.flags_low_freq ? SPI_DELAY_100KHz : SPI_DELAY_500KHz);
+			if (dev->hw_protocol.protocol == PROTOCOL_SPI)
+				protocol = init_hw_spi(MSB_FIRST, dev->hw_protocol.device_id, dev->stb_pin, dev->hw_protocol.speed_hz);
+			else
+				protocol = init_sw_spi_3w(MSB_FIRST, dev->clk_pin, dev->dat_pin, dev->stb_pin, il3829_display.flags_low_freq ? SPI_DELAY_100KHz : SPI_DELAY_500KHz);
 			if (protocol) {
 				pin_rst = dev->gpio0_pin.pin;
 				pin_dc = dev->gpio1_pin.pin;
@@ -500,6 +769,16 @@ static unsigned char il3829_init(void)
 	return 1;
 }
 
+// Also reached from init_controller() and resume, while the refresh thread may be using the bus.
+static unsigned char il3829_init(void)
+{
+	unsigned char ret;
+	mutex_lock(&bus_mutex);
+	ret = il3829_init_bus();
+	mutex_unlock(&bus_mutex);
+	return ret;
+}
+
 static unsigned char il3829_set_display_type(struct vfd_display *display)
 {
 	unsigned char ret = 0;
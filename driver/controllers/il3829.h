@@ -4,5 +4,6 @@
 #include "controller.h"
 
 struct controller_interface *init_il3829(struct vfd_dev *_dev);
+void il3829_set_full_refresh(unsigned int count, unsigned int area);
 
 #endif
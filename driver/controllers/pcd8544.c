@@ -2,6 +2,7 @@
 #include "../protocols/i2c_hw.h"
 #include "../protocols/i2c_sw.h"
 #include "../protocols/spi_sw.h"
+#include "../protocols/spi_hw.h"
 #include "pcd8544.h"
 #include "gfx_mono_ctrl.h"
 
@@ -24,7 +25,6 @@ static struct specific_gfx_mono_ctrl pcd8544_gfx_mono_ctrl = {
 	.set_power = pcd8544_set_power,
 	.set_contrast = pcd8544_set_contrast,
 	.set_xy = pcd8544_set_xy,
-	.print_char = NULL,
 	.print_string = pcd8544_print_string,
 	.write_ctrl_command_buf = pcd8544_write_ctrl_command_buf,
 	.write_ctrl_command = pcd8544_write_ctrl_command,
@@ -169,7 +169,10 @@ static unsigned char pcd8544_init(void)
 
 	if (pcd8544_display.spi.is_spi) {
 		if (dev->gpio0_pin.pin >= 0 && dev->gpio1_pin.pin >= 0) {
-			protocol = init_sw_spi_3w(MSB_FIRST, dev->clk_pin, dev->dat_pin, dev->stb_pin, pcd8544_display.flags_low_freq ? SPI_DELAY_100KHz : SPI_DELAY_500KHz);
+			if (dev->hw_protocol.protocol == PROTOCOL_SPI)
+				protocol = init_hw_spi(MSB_FIRST, dev->hw_protocol.device_id, dev->stb_pin, dev->hw_protocol.speed_hz);
+			else
+				protocol = init_sw_spi_3w(MSB_FIRST, dev->clk_pin, dev->dat_pin, dev->stb_pin, pcd8544_display.flags_low_freq ? SPI_DELAY_100KHz : SPI_DELAY_500KHz);
 			if (protocol) {
 				pin_rst = dev->gpio0_pin.pin;
 				pin_dc = dev->gpio1_pin.pin;
@@ -1,9 +1,13 @@
 #include "controller.h"
 
-#define LEDCODES_LEN	(sizeof(LED_decode_tab1)/sizeof(LED_decode_tab1[0]))
-const led_bitmap *ledCodes = LED_decode_tab1;
+static u_int8 ledLut[256];
 unsigned char ledDot = p1;
 
+void seg7_set_led_codes(const led_bitmap *codes, unsigned int len)
+{
+	build_glyph_lut(ledLut, codes, len);
+}
+
 /**
  * Source for the transpose algorithm:
    http://www.hackersdelight.org/hdcodetxt/transpose8.c.txt
@@ -25,16 +29,9 @@ void transpose8rS64(unsigned char* A, unsigned char* B) {
 	memcpy(B, &x, sizeof(x));	// Store result into output array B.
 }
 
-static unsigned char char_to_mask(unsigned char ch)
+static inline unsigned char char_to_mask(unsigned char ch)
 {
-	unsigned int index = 0;
-	for (index = 0; index < LEDCODES_LEN; index++) {
-		if (ledCodes[index].character == ch) {
-			return ledCodes[index].bitmap;
-		}
-	}
-
-	return 0;
+	return ledLut[ch];
 }
 
 size_t seg7_write_display_data(const struct vfd_display_data *data, unsigned short *raw_wdata, size_t sz)
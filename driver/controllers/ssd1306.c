@@ -2,6 +2,7 @@
 #include "../protocols/i2c_hw.h"
 #include "../protocols/i2c_sw.h"
 #include "../protocols/spi_sw.h"
+#include "../protocols/spi_hw.h"
 #include "ssd1306.h"
 #include "gfx_mono_ctrl.h"
 
@@ -19,6 +20,12 @@ static void ssd1306_write_ctrl_command(unsigned char cmd);
 static void ssd1306_write_ctrl_data_buf(const unsigned char *buf, unsigned int length);
 static void ssd1306_write_ctrl_data(unsigned char data);
 
+#define SSD1306_MAX_BANKS	8
+// Bytes around the data on I2C: a window is set, written and reset (3 x address + control, 2 x 6 command bytes),
+// the whole frame leaves the window as it is after the write (2 x address + control, 6 command bytes).
+#define SSD1306_WINDOW_COST	18
+#define SSD1306_FRAME_COST	10
+
 static struct specific_gfx_mono_ctrl ssd1306_gfx_mono_ctrl = {
 	.init = ssd1306_init,
 	.set_display_type = ssd1306_set_display_type,
@@ -26,7 +33,6 @@ static struct specific_gfx_mono_ctrl ssd1306_gfx_mono_ctrl = {
 	.set_power = ssd1306_set_power,
 	.set_contrast = ssd1306_set_contrast,
 	.set_xy = ssd1306_set_xy,
-	.print_char = NULL,
 	.print_string = ssd1306_print_string,
 	.write_ctrl_command_buf = ssd1306_write_ctrl_command_buf,
 	.write_ctrl_command = ssd1306_write_ctrl_command,
@@ -71,6 +77,8 @@ static unsigned char rows = 32;
 static unsigned char banks = 32 / 8;
 static unsigned char col_offset = 0;
 static const unsigned char ram_buffer_blank[1024] = { 0 };
+static const unsigned char ctrl_command = 0x00;
+static const unsigned char ctrl_data = 0x40;
 static int pin_rst = 0;
 static int pin_dc = 0;
 static struct ssd1306_display ssd1306_display;
@@ -89,11 +97,15 @@ struct controller_interface *init_ssd1306(struct vfd_dev *_dev)
 	case CONTROLLER_SH1106:
 		clear = sh1106_clear;
 		ssd1306_gfx_mono_ctrl.init = sh1106_init;
+		ssd1306_gfx_mono_ctrl.window_cost = 0;
+		ssd1306_gfx_mono_ctrl.frame_cost = 0;
 		break;
 	case CONTROLLER_SSD1306:
 	default:
 		clear = ssd1306_clear;
 		ssd1306_gfx_mono_ctrl.init = ssd1306_init;
+		ssd1306_gfx_mono_ctrl.window_cost = SSD1306_WINDOW_COST;
+		ssd1306_gfx_mono_ctrl.frame_cost = SSD1306_FRAME_COST;
 		break;
 	}
 	ssd1306_gfx_mono_ctrl.clear = clear;
@@ -110,6 +122,27 @@ static void ssd1306_write_ctrl_buf(unsigned char dc, const unsigned char *buf, u
 	}
 }
 
+static inline void ssd1306_set_xfer(struct protocol_xfer *xfer, const unsigned char *ctrl, const unsigned char *buf, unsigned int length)
+{
+	xfer->cmd = ctrl;
+	xfer->cmd_length = 1;
+	xfer->data = buf;
+	xfer->data_length = length;
+}
+
+// Several command / data writes in one bus transaction, 4-wire SPI has to toggle D/C in between.
+static void ssd1306_write_ctrl_batch(const struct protocol_xfer *xfers, unsigned short count)
+{
+	if (ssd1306_display.spi.is_spi && ssd1306_display.spi.is_4w) {
+		while (count--) {
+			ssd1306_write_ctrl_buf(*xfers->cmd, xfers->data, xfers->data_length);
+			xfers++;
+		}
+	} else {
+		protocol->write_cmd_data_batch(xfers, count);
+	}
+}
+
 static void ssd1306_write_ctrl_command_buf(const unsigned char *buf, unsigned int length)
 {
 	ssd1306_write_ctrl_buf(0x00, buf, length);
@@ -130,23 +163,40 @@ static void ssd1306_write_ctrl_data(unsigned char data)
 	ssd1306_write_ctrl_buf(0x40, &data, 1);
 }
 
+static void ssd1306_xy_command(unsigned char *cmd_buf, unsigned short x, unsigned short y)
+{
+	x += col_offset;
+	cmd_buf[0] = 0xB0 | (y & 0xF);
+	cmd_buf[1] = x & 0xF;
+	cmd_buf[2] = 0x10 | (x >> 4);
+}
+
 static void ssd1306_clear(void)
 {
 	unsigned char cmd_buf[] = { 0x21, col_offset, col_offset + columns - 1, 0x22, 0x00, banks - 1, 0xAE };
-	ssd1306_write_ctrl_command_buf(cmd_buf, sizeof(cmd_buf));
-	ssd1306_write_ctrl_data_buf(ram_buffer_blank, min((size_t)(columns * banks), sizeof(ram_buffer_blank)));
-	ssd1306_write_ctrl_command(0xAF);
+	unsigned char cmd_on = 0xAF;
+	struct protocol_xfer xfers[3];
+	ssd1306_set_xfer(&xfers[0], &ctrl_command, cmd_buf, sizeof(cmd_buf));
+	ssd1306_set_xfer(&xfers[1], &ctrl_data, ram_buffer_blank, min((size_t)(columns * banks), sizeof(ram_buffer_blank)));
+	ssd1306_set_xfer(&xfers[2], &ctrl_command, &cmd_on, 1);
+	ssd1306_write_ctrl_batch(xfers, ARRAY_SIZE(xfers));
 }
 
 static void sh1106_clear(void)
 {
+	unsigned char cmd_set_xy[SSD1306_MAX_BANKS][3];
+	unsigned char cmd_off = 0xAE, cmd_on = 0xAF;
+	struct protocol_xfer xfers[2 * SSD1306_MAX_BANKS + 2];
+	unsigned short count = 0;
 	unsigned char i;
-	ssd1306_write_ctrl_command(0xAE);
-	for (i = 0; i < banks; i++) {
-		ssd1306_set_xy(0, i);
-		ssd1306_write_ctrl_data_buf(ram_buffer_blank, columns);
+	ssd1306_set_xfer(&xfers[count++], &ctrl_command, &cmd_off, 1);
+	for (i = 0; i < banks && i < SSD1306_MAX_BANKS; i++) {
+		ssd1306_xy_command(cmd_set_xy[i], 0, i);
+		ssd1306_set_xfer(&xfers[count++], &ctrl_command, cmd_set_xy[i], sizeof(cmd_set_xy[i]));
+		ssd1306_set_xfer(&xfers[count++], &ctrl_data, ram_buffer_blank, columns);
 	}
-	ssd1306_write_ctrl_command(0xAF);
+	ssd1306_set_xfer(&xfers[count++], &ctrl_command, &cmd_on, 1);
+	ssd1306_write_ctrl_batch(xfers, count);
 }
 
 static void ssd1306_set_power(unsigned char state)
@@ -166,9 +216,9 @@ static void ssd1306_set_contrast(unsigned char value)
 static unsigned char ssd1306_set_xy(unsigned short x, unsigned short y)
 {
 	unsigned char ret = 0;
-	x += col_offset;
-	if (x < columns + col_offset || y < banks) {
-		unsigned char cmd_buf[] = { 0xB0 | (y & 0xF), x & 0xF, 0x10 | (x >> 4) };
+	if (x < columns || y < banks) {
+		unsigned char cmd_buf[3];
+		ssd1306_xy_command(cmd_buf, x, y);
 		ssd1306_write_ctrl_command_buf(cmd_buf, sizeof(cmd_buf));
 		ret = 1;
 	}
@@ -180,16 +230,26 @@ static void ssd1306_print_string(const unsigned char *buffer, const struct rect
 {
 	unsigned char i;
 	if (ssd1306_display.controller == CONTROLLER_SH1106) {
-		for (i = 0; i < rect->height; i++) {
-			ssd1306_set_xy(rect->x1, rect->y1 + i);
-			ssd1306_write_ctrl_data_buf(buffer + (i * rect->width), rect->width);
+		// SH1106 has no address window, every page is addressed and written separately.
+		unsigned char cmd_set_xy[SSD1306_MAX_BANKS][3];
+		struct protocol_xfer xfers[2 * SSD1306_MAX_BANKS];
+		unsigned char height = min_t(unsigned char, rect->height, SSD1306_MAX_BANKS);
+		for (i = 0; i < height; i++) {
+			ssd1306_xy_command(cmd_set_xy[i], rect->x1, rect->y1 + i);
+			ssd1306_set_xfer(&xfers[2 * i], &ctrl_command, cmd_set_xy[i], sizeof(cmd_set_xy[i]));
+			ssd1306_set_xfer(&xfers[2 * i + 1], &ctrl_data, buffer + (i * rect->width), rect->width);
 		}
+		ssd1306_write_ctrl_batch(xfers, 2 * height);
 	} else {
 		unsigned char cmd_set_addr_range[] = { 0x21, rect->x1 + col_offset, rect->x2 + col_offset, 0x22, rect->y1, rect->y2 };
 		unsigned char cmd_reset_addr_range[] = { 0x21, col_offset, col_offset + columns - 1, 0x22, 0x00, banks - 1 };
-		ssd1306_write_ctrl_command_buf(cmd_set_addr_range, sizeof(cmd_set_addr_range));
-		ssd1306_write_ctrl_data_buf(buffer, rect->length * rect->font->font_char_size);
-		ssd1306_write_ctrl_command_buf(cmd_reset_addr_range, sizeof(cmd_reset_addr_range));
+		struct protocol_xfer xfers[3];
+		// A full frame wraps the address back to the start of the window, which then needs no reset.
+		unsigned char is_full = rect->width == columns && rect->height == banks;
+		ssd1306_set_xfer(&xfers[0], &ctrl_command, cmd_set_addr_range, sizeof(cmd_set_addr_range));
+		ssd1306_set_xfer(&xfers[1], &ctrl_data, buffer, rect->width * rect->height);
+		ssd1306_set_xfer(&xfers[2], &ctrl_command, cmd_reset_addr_range, sizeof(cmd_reset_addr_range));
+		ssd1306_write_ctrl_batch(xfers, is_full ? 2 : ARRAY_SIZE(xfers));
 	}
 }
 
@@ -197,7 +257,10 @@ static void init_protocol(void)
 {
 	if (ssd1306_display.spi.is_spi) {
 		if (dev->gpio0_pin.pin >= 0 && (!ssd1306_display.spi.is_4w || dev->gpio1_pin.pin >= 0)) {
-			protocol = init_sw_spi_3w(MSB_FIRST, dev->clk_pin, dev->dat_pin, dev->stb_pin, ssd1306_display.flags_low_freq ? SPI_DELAY_100KHz : SPI_DELAY_500KHz);
+			if (dev->hw_protocol.protocol == PROTOCOL_SPI)
+				protocol = init_hw_spi(MSB_FIRST, dev->hw_protocol.device_id, dev->stb_pin, dev->hw_protocol.speed_hz);
+			else
+				protocol = init_sw_spi_3w(MSB_FIRST, dev->clk_pin, dev->dat_pin, dev->stb_pin, ssd1306_display.flags_low_freq ? SPI_DELAY_100KHz : SPI_DELAY_500KHz);
 			if (protocol) {
 				pin_rst = dev->gpio0_pin.pin;
 				pin_dc = dev->gpio1_pin.pin;
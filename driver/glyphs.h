@@ -336,4 +336,16 @@ static const led_bitmap LED_decode_tab5[] = {
 	{'_', a5}, {'-', g5}, {' ', 0}, { 0xB0, c5|d5|e5|g5 }
 };
 
+#define LED_DECODE_LEN(tab)	(sizeof(tab) / sizeof((tab)[0]))
+
+/** Builds a direct character to bitmap lookup table from a decode table, the first entry of a character wins. */
+static inline void build_glyph_lut(u_int8 lut[256], const led_bitmap *tab, unsigned int len)
+{
+	unsigned int i;
+	for (i = 0; i < 256; i++)
+		lut[i] = 0;
+	while (len--)
+		lut[tab[len].character] = tab[len].bitmap;
+}
+
 #endif
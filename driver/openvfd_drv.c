@@ -34,8 +34,24 @@
 #include <linux/poll.h>
 #include <linux/gpio.h>
 #include <linux/of_gpio.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/input.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/time.h>
+#include <linux/math64.h>
 #include "openvfd_drv.h"
 #include "controllers/controller_list.h"
+#include "controllers/gfx_mono_ctrl.h"
+#include "protocols/bus_timing.h"
+#include "protocols/i2c_hw.h"
+#include "protocols/spi_hw.h"
+#include "openvfd_fb.h"
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
 #include <linux/earlysuspend.h>
@@ -46,6 +62,9 @@ static struct early_suspend openvfd_early_suspend;
 #endif
 
 unsigned char vfd_display_auto_power = 1;
+unsigned int vfd_max_fps = 30;
+unsigned int vfd_key_scan_ms = 20;
+unsigned char vfd_key_debounce = 2;
 
 static struct vfd_platform_data *pdata = NULL;
 struct kp {
@@ -55,7 +74,67 @@ struct kp {
 static struct kp *kp;
 
 static struct controller_interface *controller = NULL;
+/*
+ * mutex serializes the controller and its bus. Reconfiguring the controller
+ * (display type, character order, DTB defaults) also takes config_rwsem for
+ * writing first, so dtb_active is only written with both held and either one
+ * is enough to read it. Paths which don't otherwise touch the bus read it
+ * under config_rwsem. The mode, brightness and status LED bytes and the key
+ * scan state are kept off mutex, so they don't wait behind a slow controller
+ * update.
+ */
 static struct mutex mutex;
+static DECLARE_RWSEM(config_rwsem);
+// Live mappings of the frame buffer, its geometry can't change while there are any.
+static atomic_t fb_map_count = ATOMIC_INIT(0);
+
+/*
+ * Display data written from userspace is only latched into pending_data,
+ * the bus transfer happens later from flush_work. Frames that arrive while
+ * a flush is pending simply overwrite the slot, so only the newest one is
+ * ever sent to the controller.
+ */
+static DEFINE_SPINLOCK(pending_lock);
+static struct vfd_display_data pending_data;
+static unsigned char pending_valid = 0;
+static unsigned long last_flush = 0;
+static void flush_work_handler(struct work_struct *work);
+static DECLARE_DELAYED_WORK(flush_work, flush_work_handler);
+// Last frame written from userspace, delta updates are applied to it.
+static DEFINE_MUTEX(frame_mutex);
+static struct vfd_display_data frame_data;
+#define DELTA_STACK_SIZE	64
+
+/*
+ * While the device is open, the key RAM of the controllers which have a key
+ * scanner is sampled every vfd_key_scan_ms. A new key state is reported once
+ * it was read vfd_key_debounce times in a row, readers blocked in poll() are
+ * woken up and the state is returned by the next read(). open_count, key_input
+ * and the key state are guarded by state_lock.
+ */
+static unsigned int open_count = 0;
+static u_int32 key_sample = 0;
+/*
+ * Keys which are mapped through vfd_keymap (or the openvfd_keymap DT
+ * property) are also reported through an input device, keeping the scan
+ * running regardless of /dev/openvfd being open. Each keymap entry is
+ * (key bit << 16) | key code, the key bit indexes the FD628_GetKey() value.
+ */
+#define KEYMAP_SIZE	32
+static struct input_dev *key_input = NULL;
+static unsigned short key_codes[KEYMAP_SIZE];
+static void key_scan_work_handler(struct work_struct *work);
+static DECLARE_DELAYED_WORK(key_scan_work, key_scan_work_handler);
+
+/*
+ * Autonomous clock, an hrtimer on the wall clock half second edges builds
+ * the clock frame and hands it to the flush worker like a userspace write.
+ * clock_config is only changed with the timer cancelled.
+ */
+static struct vfd_clock_config clock_config = { 0 };
+static struct vfd_display_data clock_data;
+static struct hrtimer clock_timer;
+static void queue_display_data(const struct vfd_display_data *data);
 
 /****************************************************************
  *	Function Name:		FD628_GetKey
@@ -70,10 +149,11 @@ KEYI2 	| bit31	| bit30	| bit29	| bit28	| bit27	| bit26	| bit25	| bit24	| bit23	|
 ***************************************************************************************************************************************/
 static u_int32 FD628_GetKey(struct vfd_dev *dev)
 {
-	u_int8 i, keyDataBytes[5];
+	u_int8 i, keyDataBytes[5] = { 0 };
 	u_int32 FD628_KeyData = 0;
 	mutex_lock(&mutex);
-	controller->read_data(keyDataBytes, sizeof(keyDataBytes));
+	if (controller->read_data(keyDataBytes, sizeof(keyDataBytes)) == (size_t)-1)
+		memset(keyDataBytes, 0, sizeof(keyDataBytes));
 	mutex_unlock(&mutex);
 	for (i = 0; i != 5; i++) {			/* Pack 5 bytes of key code values into 2 words */
 		if (keyDataBytes[i] & 0x01)
@@ -89,6 +169,141 @@ static u_int32 FD628_GetKey(struct vfd_dev *dev)
 	return (FD628_KeyData);
 }
 
+static void build_clock_data(struct vfd_display_data *data)
+{
+	struct tm tm;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0)
+	struct timespec64 now;
+	ktime_get_real_ts64(&now);
+#else
+	struct timespec now;
+	getnstimeofday(&now);
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,8,0)
+	time64_to_tm(now.tv_sec, clock_config.utc_offset, &tm);
+#else
+	time_to_tm(now.tv_sec, clock_config.utc_offset, &tm);
+#endif
+
+	memset(data, 0, sizeof(*data));
+	data->mode = (clock_config.flags & VFD_CLOCK_FLAG_DATE) ? DISPLAY_MODE_DATE : DISPLAY_MODE_CLOCK;
+	data->colon_on = now.tv_nsec < NSEC_PER_SEC / 2;
+	data->time_date.hours = tm.tm_hour;
+	if (clock_config.flags & VFD_CLOCK_FLAG_12H) {
+		if (tm.tm_hour == 0)
+			data->time_date.hours = 12;
+		else if (tm.tm_hour > 12)
+			data->time_date.hours = tm.tm_hour - 12;
+	}
+	data->time_date.minutes = tm.tm_min;
+	data->time_date.seconds = tm.tm_sec;
+	data->time_date.day_of_week = tm.tm_wday;
+	data->time_date.day = tm.tm_mday;
+	data->time_date.month = tm.tm_mon;
+	data->time_date.year = tm.tm_year + 1900;
+	data->time_secondary._reserved = clock_config.date_format;
+}
+
+static enum hrtimer_restart clock_timer_handler(struct hrtimer *timer)
+{
+	const s64 half_second = NSEC_PER_SEC / 2;
+	s64 next = (div_s64(ktime_to_ns(ktime_get_real()), half_second) + 1) * half_second;
+
+	build_clock_data(&clock_data);
+	queue_display_data(&clock_data);
+	hrtimer_set_expires(timer, ns_to_ktime(next));
+	return HRTIMER_RESTART;
+}
+
+static void start_clock(void)
+{
+	if (clock_config.enabled)
+		hrtimer_start(&clock_timer, ktime_get_real(), HRTIMER_MODE_ABS);
+}
+
+static void set_clock_config(const struct vfd_clock_config *config)
+{
+	hrtimer_cancel(&clock_timer);
+	clock_config = *config;
+	start_clock();
+}
+
+static void disable_clock(void)
+{
+	struct vfd_clock_config config;
+	if (!clock_config.enabled)
+		return;
+	mutex_lock(&mutex);
+	config = clock_config;
+	config.enabled = 0;
+	set_clock_config(&config);
+	mutex_unlock(&mutex);
+}
+
+static unsigned char has_key_scan(struct vfd_dev *dev)
+{
+	return vfd_key_scan_ms && dev->dtb_active.display.controller < CONTROLLER_7S_MAX;
+}
+
+// Called with state_lock held.
+static unsigned char is_key_scan_wanted(void)
+{
+	return (open_count || key_input) && vfd_key_scan_ms;
+}
+
+static void report_keys(u_int32 old_value, u_int32 new_value)
+{
+	u_int32 changed = old_value ^ new_value;
+	unsigned int i;
+	if (!key_input || !changed)
+		return;
+	for (i = 0; i < KEYMAP_SIZE; i++)
+		if ((changed & (1U << i)) && key_codes[i] != KEY_RESERVED)
+			input_report_key(key_input, key_codes[i], (new_value >> i) & 0x01);
+	input_sync(key_input);
+}
+
+static void key_scan_work_handler(struct work_struct *work)
+{
+	struct vfd_dev *dev = pdata->dev;
+	u_int32 value;
+	u_int8 debounce = max(vfd_key_debounce, (unsigned char)1);
+	unsigned long flags;
+	unsigned char rearm;
+
+	down_read(&config_rwsem);
+	if (has_key_scan(dev)) {
+		value = FD628_GetKey(dev);
+		spin_lock_irqsave(&dev->state_lock, flags);
+		if (value != key_sample) {
+			key_sample = value;
+			dev->KeyPressCnt = 1;
+		} else if (dev->KeyPressCnt < debounce) {
+			dev->KeyPressCnt++;
+		}
+		if (dev->KeyPressCnt == debounce && value != dev->key_value) {
+			report_keys(dev->key_value, value);
+			dev->key_value = value;
+			dev->key_respond_status = 1;
+			wake_up_interruptible(&dev->kb_waitq);
+		}
+		spin_unlock_irqrestore(&dev->state_lock, flags);
+	}
+	up_read(&config_rwsem);
+	// The scan stops by itself once the device was closed, or if it was disabled.
+	spin_lock_irqsave(&dev->state_lock, flags);
+	rearm = is_key_scan_wanted();
+	spin_unlock_irqrestore(&dev->state_lock, flags);
+	if (rearm)
+		queue_delayed_work(system_long_wq, &key_scan_work, max(msecs_to_jiffies(vfd_key_scan_ms), 1UL));
+}
+
+static void start_key_scan(void)
+{
+	if (vfd_key_scan_ms)
+		queue_delayed_work(system_long_wq, &key_scan_work, 0);
+}
+
 static void unlocked_set_power(unsigned char state)
 {
 	if (vfd_display_auto_power && controller) {
@@ -105,6 +320,7 @@ static void set_power(unsigned char state)
 	mutex_unlock(&mutex);
 }
 
+// Called with config_rwsem held for writing and mutex held.
 static void init_controller(struct vfd_dev *dev)
 {
 	struct controller_interface *temp_ctlr;
@@ -172,17 +388,33 @@ static void init_controller(struct vfd_dev *dev)
 static int openvfd_dev_open(struct inode *inode, struct file *file)
 {
 	struct vfd_dev *dev = NULL;
+	unsigned long flags;
 	file->private_data = pdata->dev;
 	dev = file->private_data;
 	memset(dev->wbuf, 0x00, sizeof(dev->wbuf));
 	set_power(1);
+	spin_lock_irqsave(&dev->state_lock, flags);
+	if (!open_count++)
+		start_key_scan();
+	spin_unlock_irqrestore(&dev->state_lock, flags);
 	pr_dbg("openvfd_dev_open now.............................\r\n");
 	return 0;
 }
 
 static int openvfd_dev_release(struct inode *inode, struct file *file)
 {
-	set_power(0);
+	struct vfd_dev *dev = file->private_data;
+	unsigned long flags;
+	flush_delayed_work(&flush_work);
+	spin_lock_irqsave(&dev->state_lock, flags);
+	if (open_count)
+		open_count--;
+	spin_unlock_irqrestore(&dev->state_lock, flags);
+	mutex_lock(&mutex);
+	// Keep the display on while the autonomous clock is running.
+	if (!clock_config.enabled)
+		unlocked_set_power(0);
+	mutex_unlock(&mutex);
 	file->private_data = NULL;
 	pr_dbg("succes to close  openvfd_dev.............\n");
 	return 0;
@@ -196,13 +428,24 @@ static ssize_t openvfd_dev_read(struct file *filp, char __user * buf,
 	__u32 diskvalue = 0;
 	int ret = 0;
 	int rbuf[2] = { 0 };
+	unsigned long flags;
+	unsigned char is_key_read = 0;
 	//pr_dbg("start read keyboard value...............\r\n");
-	if (dev->Keyboard_diskstatus == 1) {
+	down_read(&config_rwsem);
+	if (has_key_scan(dev)) {
+		spin_lock_irqsave(&dev->state_lock, flags);
+		diskvalue = dev->key_value;
+		dev->key_respond_status = 0;
+		spin_unlock_irqrestore(&dev->state_lock, flags);
+		is_key_read = 1;
+	} else if (dev->Keyboard_diskstatus == 1) {
+		dev->key_respond_status = 0;
 		diskvalue = FD628_GetKey(dev);
-		if (diskvalue == 0)
-			return 0;
+		is_key_read = 1;
 	}
-	dev->key_respond_status = 0;
+	up_read(&config_rwsem);
+	if (is_key_read && diskvalue == 0)
+		return 0;
 	rbuf[1] = dev->key_fg;
 	if (dev->key_fg)
 		rbuf[0] = disk;
@@ -216,6 +459,143 @@ static ssize_t openvfd_dev_read(struct file *filp, char __user * buf,
 		return ret;
 }
 
+static void flush_work_handler(struct work_struct *work)
+{
+	static struct vfd_display_data data;
+	unsigned long flags;
+	unsigned char valid;
+
+	spin_lock_irqsave(&pending_lock, flags);
+	valid = pending_valid;
+	if (valid)
+		data = pending_data;
+	pending_valid = 0;
+	spin_unlock_irqrestore(&pending_lock, flags);
+	if (!valid)
+		return;
+
+	mutex_lock(&mutex);
+	if (controller && !controller->write_display_data(&data))
+		pr_error("openvfd flush failed to write display_data\n");
+	last_flush = jiffies;
+	mutex_unlock(&mutex);
+}
+
+static void queue_display_data(const struct vfd_display_data *data)
+{
+	unsigned long flags, next, delay = 0;
+
+	spin_lock_irqsave(&pending_lock, flags);
+	pending_data = *data;
+	pending_valid = 1;
+	spin_unlock_irqrestore(&pending_lock, flags);
+
+	if (vfd_max_fps) {
+		next = last_flush + msecs_to_jiffies(1000 / min(vfd_max_fps, 1000U));
+		if (time_before(jiffies, next))
+			delay = next - jiffies;
+	}
+	// No-op if a flush is already queued, it will pick up the new frame.
+	queue_delayed_work(system_long_wq, &flush_work, delay);
+}
+
+static void discard_display_data(void)
+{
+	unsigned long flags;
+	cancel_delayed_work_sync(&flush_work);
+	spin_lock_irqsave(&pending_lock, flags);
+	pending_valid = 0;
+	spin_unlock_irqrestore(&pending_lock, flags);
+}
+
+#define DELTA_FIELD(tag, field)	[tag] = { offsetof(struct vfd_display_data, field), sizeof(((struct vfd_display_data *)0)->field) }
+static const struct {
+	unsigned short offset;
+	unsigned short size;
+} delta_fields[VFD_DELTA_MAX] = {
+	DELTA_FIELD(VFD_DELTA_MODE, mode),
+	DELTA_FIELD(VFD_DELTA_COLON, colon_on),
+	DELTA_FIELD(VFD_DELTA_TEMPERATURE, temperature),
+	DELTA_FIELD(VFD_DELTA_TIME_DATE, time_date),
+	DELTA_FIELD(VFD_DELTA_TIME_SECONDARY, time_secondary),
+	DELTA_FIELD(VFD_DELTA_CHANNEL, channel_data),
+	DELTA_FIELD(VFD_DELTA_STRING_MAIN, string_main),
+	DELTA_FIELD(VFD_DELTA_STRING_SECONDARY, string_secondary),
+};
+
+/*
+ * The update is validated in the first pass and only applied in the second,
+ * so a malformed update leaves the frame untouched.
+ */
+static int apply_display_delta(struct vfd_display_data *data, const unsigned char *buf, size_t count)
+{
+	const struct vfd_delta_header *header = (const struct vfd_delta_header *)buf;
+	struct vfd_delta_record record;
+	unsigned char pass, i;
+	size_t pos;
+
+	for (pass = 0; pass < 2; pass++) {
+		pos = sizeof(*header);
+		for (i = 0; i < header->count; i++) {
+			if (pos + sizeof(record) > count)
+				return -EINVAL;
+			memcpy(&record, buf + pos, sizeof(record));
+			pos += sizeof(record);
+			if (record.tag >= VFD_DELTA_MAX || pos + record.length > count ||
+				record.offset + record.length > delta_fields[record.tag].size)
+				return -EINVAL;
+			if (pass)
+				memcpy((unsigned char *)data + delta_fields[record.tag].offset + record.offset, buf + pos, record.length);
+			pos += record.length;
+		}
+		if (pos != count)
+			return -EINVAL;
+	}
+	data->string_main[sizeof(data->string_main) - 1] = '\0';
+	data->string_secondary[sizeof(data->string_secondary) - 1] = '\0';
+	return 0;
+}
+
+// Longest update the header can describe, every record replacing as much of its field as possible.
+static size_t max_delta_size(const struct vfd_delta_header *header)
+{
+	size_t record_size = 0;
+	unsigned char i;
+	for (i = 0; i < VFD_DELTA_MAX; i++)
+		record_size = max_t(size_t, record_size, min_t(size_t, delta_fields[i].size, (u_int8)~0));
+	return sizeof(*header) + header->count * (sizeof(struct vfd_delta_record) + record_size);
+}
+
+static ssize_t write_display_delta(const char __user *buf, size_t count)
+{
+	unsigned char stack_buf[DELTA_STACK_SIZE];
+	unsigned char *delta;
+	struct vfd_delta_header header;
+	ssize_t status = 0;
+
+	// The size comes from userspace, validate the header before allocating anything.
+	if (copy_from_user(&header, buf, sizeof(header)))
+		return -EFAULT;
+	if (memcmp(header.magic, VFD_DELTA_MAGIC, sizeof(header.magic)) || header.version != VFD_DELTA_VERSION ||
+		count > max_delta_size(&header))
+		return -EINVAL;
+	delta = count <= sizeof(stack_buf) ? stack_buf : kmalloc(count, GFP_KERNEL);
+	if (!delta)
+		return -ENOMEM;
+	if (copy_from_user(delta, buf, count)) {
+		status = -EFAULT;
+	} else {
+		mutex_lock(&frame_mutex);
+		status = apply_display_delta(&frame_data, delta, count);
+		if (!status)
+			queue_display_data(&frame_data);
+		mutex_unlock(&frame_mutex);
+	}
+	if (delta != stack_buf)
+		kfree(delta);
+	return status;
+}
+
 /**
  * @param buf: Incoming LED codes.
  * 		  [0]	Display indicators mask (wifi, eth, usb, etc.)
@@ -227,26 +607,32 @@ static ssize_t openvfd_dev_write(struct file *filp, const char __user * buf,
 {
 	ssize_t status = 0;
 	unsigned long missing;
-	static struct vfd_display_data data;
+	struct vfd_display_data data;
+	unsigned char magic[sizeof(((struct vfd_delta_header *)0)->magic)];
 
+	// Frames written from userspace take over from the autonomous clock.
+	if (count > 0)
+		disable_clock();
 	if (count == sizeof(data)) {
 		missing = copy_from_user(&data, buf, count);
 		if (missing == 0 && count > 0) {
-			mutex_lock(&mutex);
-			if (controller->write_display_data(&data))
-				pr_dbg("openvfd_dev_write count : %ld\n", count);
-			else {
-				status = -1;
-				pr_error("openvfd_dev_write failed to write %ld bytes (display_data)\n", count);
-			}
-			mutex_unlock(&mutex);
+			mutex_lock(&frame_mutex);
+			frame_data = data;
+			queue_display_data(&frame_data);
+			mutex_unlock(&frame_mutex);
+			pr_dbg("openvfd_dev_write count : %ld\n", count);
 		}
+	} else if (count >= sizeof(struct vfd_delta_header) && !copy_from_user(magic, buf, sizeof(magic)) &&
+			!memcmp(magic, VFD_DELTA_MAGIC, sizeof(magic))) {
+		status = write_display_delta(buf, count);
 	} else if (count > 0) {
 		unsigned char *raw_data;
 		pr_dbg2("openvfd_dev_write: count = %ld, sizeof(data) = %ld\n", count, sizeof(data));
 		raw_data = kzalloc(count, GFP_KERNEL);
 		if (raw_data) {
 			missing = copy_from_user(raw_data, buf, count);
+			// Keep raw writes ordered after any display data still pending.
+			flush_delayed_work(&flush_work);
 			mutex_lock(&mutex);
 			if (controller->write_data((unsigned char*)raw_data, count))
 				pr_dbg("openvfd_dev_write count : %ld\n", count);
@@ -271,12 +657,31 @@ static int set_display_brightness(struct vfd_dev *dev, u_int8 new_brightness)
 	return controller->set_brightness_level(new_brightness);
 }
 
+// Same locking as init_controller().
 static void set_display_type(struct vfd_dev *dev, int new_display_type)
 {
 	memcpy(&dev->dtb_active.display, &new_display_type, sizeof(struct vfd_display));
 	init_controller(dev);
 }
 
+static unsigned char is_config_cmd(unsigned int cmd)
+{
+	return cmd == VFD_IOC_USE_DTB_CONFIG || cmd == VFD_IOC_SDISPLAY_TYPE || cmd == VFD_IOC_SCHARS_ORDER;
+}
+
+// Taken before mutex by the commands which reconfigure the controller.
+static int lock_config(unsigned int cmd)
+{
+	if (!is_config_cmd(cmd))
+		return 0;
+	down_write(&config_rwsem);
+	if (cmd != VFD_IOC_SCHARS_ORDER && atomic_read(&fb_map_count)) {
+		up_write(&config_rwsem);
+		return -EBUSY;
+	}
+	return 0;
+}
+
 static long openvfd_dev_ioctl(struct file *filp, unsigned int cmd,
 				unsigned long arg)
 {
@@ -284,6 +689,9 @@ static long openvfd_dev_ioctl(struct file *filp, unsigned int cmd,
 	struct vfd_dev *dev;
 	__u8 val = 1;
 	__u8 temp_chars_order[sizeof(dev->dtb_active.dat_index)];
+	struct vfd_fb_info fb_info;
+	struct vfd_fb_rect fb_rect;
+	struct vfd_clock_config clock_cfg;
 	dev = filp->private_data;
 
 	if (_IOC_TYPE(cmd) != VFD_IOC_MAGIC)
@@ -305,16 +713,45 @@ static long openvfd_dev_ioctl(struct file *filp, unsigned int cmd,
 	if (err)
 		return -EFAULT;
 
+	// State only commands, these don't touch the controller.
+	switch (cmd) {
+	case VFD_IOC_GDISPLAY_TYPE:
+		down_read(&config_rwsem);
+		memcpy(&temp, &dev->dtb_active.display, sizeof(int));
+		up_read(&config_rwsem);
+		return __put_user(temp, (int __user *)arg);
+	case VFD_IOC_SMODE:	/* Set: arg points to the value */
+		ret = __get_user(temp, (int __user *)arg);
+		if (!ret)
+			dev->mode = (u_int8)temp;
+		//FD628_SET_DISPLAY_MODE(dev->mode, dev);
+		return ret;
+	case VFD_IOC_GMODE:	/* Get: arg is pointer to result */
+		return __put_user(dev->mode, (int __user *)arg);
+	case VFD_IOC_GVER:
+		return copy_to_user((unsigned char __user *)arg,
+				OPENVFD_DRIVER_VERSION,
+				sizeof(OPENVFD_DRIVER_VERSION));
+	case VFD_IOC_GBRIGHT:
+		return __put_user(dev->brightness, (int __user *)arg);
+	case VFD_IOC_STATUS_LED:
+		ret = __get_user(temp, (int __user *)arg);
+		if (!ret)
+			vfd_update_status_led_mask(dev, 0xFF, (u_int8)temp);
+		return ret;
+	case VFD_IOC_GDELTA_VERSION:
+		return __put_user(VFD_DELTA_VERSION, (int __user *)arg);
+	}
+
+	ret = lock_config(cmd);
+	if (ret)
+		return ret;
 	mutex_lock(&mutex);
 	switch (cmd) {
 	case VFD_IOC_USE_DTB_CONFIG:
 		dev->dtb_active = dev->dtb_default;
 		init_controller(dev);
 		break;
-	case VFD_IOC_GDISPLAY_TYPE:
-		memcpy(&temp, &dev->dtb_active.display, sizeof(int));
-		ret = __put_user(temp, (int __user *)arg);
-		break;
 	case VFD_IOC_SDISPLAY_TYPE:
 		ret = __get_user(temp, (int __user *)arg);
 		if (!ret)
@@ -325,33 +762,37 @@ static long openvfd_dev_ioctl(struct file *filp, unsigned int cmd,
 		if (!ret)
 			memcpy(dev->dtb_active.dat_index, temp_chars_order, sizeof(dev->dtb_active.dat_index));
 		break;
-	case VFD_IOC_SMODE:	/* Set: arg points to the value */
-		ret = __get_user(dev->mode, (int __user *)arg);
-		//FD628_SET_DISPLAY_MODE(dev->mode, dev);
-		break;
-	case VFD_IOC_GMODE:	/* Get: arg is pointer to result */
-		ret = __put_user(dev->mode, (int __user *)arg);
-		break;
-	case VFD_IOC_GVER:
-		ret =
-			copy_to_user((unsigned char __user *)arg,
-				 OPENVFD_DRIVER_VERSION,
-				 sizeof(OPENVFD_DRIVER_VERSION));
-		break;
 	case VFD_IOC_SBRIGHT:
 		ret = __get_user(temp, (int __user *)arg);
 		if (!ret && !set_display_brightness(dev, (u_int8)temp))
 			ret = -ERANGE;
 		break;
-	case VFD_IOC_GBRIGHT:
-		ret = __put_user(dev->brightness, (int __user *)arg);
-		break;
 	case VFD_IOC_POWER:
 		ret = __get_user(val, (int __user *)arg);
 		controller->set_power(val);
 		break;
-	case VFD_IOC_STATUS_LED:
-		ret = __get_user(dev->status_led_mask, (int __user *)arg);
+	case VFD_IOC_GFB_INFO:
+		if (controller->get_framebuffer && controller->get_framebuffer(&fb_info))
+			ret = __copy_to_user((void __user *)arg, &fb_info, sizeof(fb_info)) ? -EFAULT : 0;
+		else
+			ret = -ENODEV;
+		break;
+	case VFD_IOC_FB_FLUSH:
+		if (!controller->flush_framebuffer)
+			ret = -ENODEV;
+		else if (__copy_from_user(&fb_rect, (void __user *)arg, sizeof(fb_rect)))
+			ret = -EFAULT;
+		else if (!controller->flush_framebuffer(&fb_rect))
+			ret = -EINVAL;
+		break;
+	case VFD_IOC_SCLOCK:
+		if (__copy_from_user(&clock_cfg, (void __user *)arg, sizeof(clock_cfg)))
+			ret = -EFAULT;
+		else
+			set_clock_config(&clock_cfg);
+		break;
+	case VFD_IOC_GCLOCK:
+		ret = __copy_to_user((void __user *)arg, &clock_config, sizeof(clock_config)) ? -EFAULT : 0;
 		break;
 	default:		/* redundant, as cmd was checked against MAXNR */
 		ret = -ENOTTY;
@@ -359,9 +800,57 @@ static long openvfd_dev_ioctl(struct file *filp, unsigned int cmd,
 	}
 
 	mutex_unlock(&mutex);
+	if (is_config_cmd(cmd))
+		up_write(&config_rwsem);
 	return ret;
 }
 
+static void openvfd_vm_open(struct vm_area_struct *vma)
+{
+	atomic_inc(&fb_map_count);
+}
+
+static void openvfd_vm_close(struct vm_area_struct *vma)
+{
+	atomic_dec(&fb_map_count);
+}
+
+static const struct vm_operations_struct openvfd_vm_ops = {
+	.open = openvfd_vm_open,
+	.close = openvfd_vm_close,
+};
+
+/*
+ * Maps the frame buffer of graphical controllers, allocated with
+ * vmalloc_user(). The mapping is counted before the geometry is read, so a
+ * reconfiguration either completes first or fails with -EBUSY.
+ */
+static int openvfd_dev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct vfd_fb_info info;
+	unsigned char *fb = NULL;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int ret;
+
+	atomic_inc(&fb_map_count);
+	mutex_lock(&mutex);
+	if (controller->get_framebuffer)
+		fb = controller->get_framebuffer(&info);
+	mutex_unlock(&mutex);
+	if (!fb)
+		ret = -ENODEV;
+	else if (vma->vm_pgoff || size > info.size)
+		ret = -EINVAL;
+	else
+		ret = remap_vmalloc_range(vma, fb, 0);
+	if (ret) {
+		atomic_dec(&fb_map_count);
+		return ret;
+	}
+	vma->vm_ops = &openvfd_vm_ops;
+	return 0;
+}
+
 static unsigned int openvfd_dev_poll(struct file *filp, poll_table * wait)
 {
 	unsigned int mask = 0;
@@ -380,6 +869,7 @@ static struct file_operations openvfd_fops = {
 	.write = openvfd_dev_write,
 	.unlocked_ioctl = openvfd_dev_ioctl,
 	.compat_ioctl = openvfd_dev_ioctl,
+	.mmap = openvfd_dev_mmap,
 	.poll = openvfd_dev_poll,
 };
 
@@ -443,8 +933,10 @@ static ssize_t led_cmd_show(struct device *dev,
 			ret = scnprintf(buf, PAGE_SIZE, "%s", OPENVFD_DRIVER_VERSION);
 			break;
 		case VFD_IOC_GDISPLAY_TYPE:
+			down_read(&config_rwsem);
 			ret = scnprintf(buf, PAGE_SIZE, "0x%02X%02X%02X%02X", pdata->dev->dtb_active.display.reserved, pdata->dev->dtb_active.display.flags,
 				pdata->dev->dtb_active.display.controller, pdata->dev->dtb_active.display.type);
+			up_read(&config_rwsem);
 			break;
 	}
 
@@ -469,12 +961,26 @@ static ssize_t led_cmd_store(struct device *_dev,
 
 	buf += sizeof(int);
 	memcpy(&temp, buf, sizeof(int));
-	mutex_lock(&mutex);
 	switch (cmd) {
 		case VFD_IOC_SMODE:
 			dev->mode = (u_int8)temp;
 			//FD628_SET_DISPLAY_MODE(dev->mode, dev);
-			break;
+			return size;
+		case VFD_IOC_STATUS_LED:
+			vfd_update_status_led_mask(dev, 0xFF, (u_int8)temp);
+			return size;
+		case VFD_IOC_GMODE:
+		case VFD_IOC_GBRIGHT:
+		case VFD_IOC_GVER:
+		case VFD_IOC_GDISPLAY_TYPE:
+			led_cmd_ioc = cmd;
+			return size;
+	}
+
+	if (lock_config(cmd))
+		return -EBUSY;
+	mutex_lock(&mutex);
+	switch (cmd) {
 		case VFD_IOC_SBRIGHT:
 			if (!set_display_brightness(dev, (u_int8)temp))
 				size = -ERANGE;
@@ -482,9 +988,6 @@ static ssize_t led_cmd_store(struct device *_dev,
 		case VFD_IOC_POWER:
 			controller->set_power(temp);
 			break;
-		case VFD_IOC_STATUS_LED:
-			dev->status_led_mask = (u_int8)temp;
-			break;
 		case VFD_IOC_SDISPLAY_TYPE:
 			set_display_type(dev, temp);
 			break;
@@ -498,15 +1001,11 @@ static ssize_t led_cmd_store(struct device *_dev,
 			pdata->dev->dtb_active = pdata->dev->dtb_default;
 			init_controller(dev);
 			break;
-		case VFD_IOC_GMODE:
-		case VFD_IOC_GBRIGHT:
-		case VFD_IOC_GVER:
-		case VFD_IOC_GDISPLAY_TYPE:
-			led_cmd_ioc = cmd;
-			break;
 	}
 
 	mutex_unlock(&mutex);
+	if (is_config_cmd(cmd))
+		up_write(&config_rwsem);
 	return size;
 }
 
@@ -567,9 +1066,14 @@ unsigned int vfd_gpio1[3] = { 0x00, 0x00, 0xFF };
 unsigned int vfd_gpio2[3] = { 0x00, 0x00, 0xFF };
 unsigned int vfd_gpio3[3] = { 0x00, 0x00, 0xFF };
 unsigned int vfd_gpio_protocol[2] = { 0x00, 0x00 };
+unsigned int vfd_hw_spi_speed = SPI_HW_DEFAULT_SPEED_HZ;
+unsigned int vfd_sw_bus_speed = 0;
+unsigned int vfd_eink_full_refresh[2] = { 0, 0 };
 unsigned int vfd_chars[7] = { 0, 1, 2, 3, 4, 5, 6 };
 unsigned int vfd_dot_bits[8] = { 0, 1, 2, 3, 4, 5, 6, 0 };
 unsigned int vfd_display_type[4] = { 0x00, 0x00, 0x00, 0x00 };
+unsigned char vfd_fbdev = 0;
+unsigned int vfd_keymap[KEYMAP_SIZE];
 int vfd_gpio_clk_argc = 0;
 int vfd_gpio_dat_argc = 0;
 int vfd_gpio_stb_argc = 0;
@@ -578,9 +1082,33 @@ int vfd_gpio1_argc = 3;
 int vfd_gpio2_argc = 3;
 int vfd_gpio3_argc = 3;
 int vfd_gpio_protocol_argc = 2;
+int vfd_eink_full_refresh_argc = 0;
 int vfd_chars_argc = 0;
 int vfd_dot_bits_argc = 0;
 int vfd_display_type_argc = 0;
+int vfd_keymap_argc = 0;
+
+/*
+ * The scan stops rearming itself while disabled, restart it when it is enabled
+ * again. Values given at load time are set before the device was probed.
+ */
+static int key_scan_ms_set(const char *val, const struct kernel_param *param)
+{
+	unsigned long flags;
+	int ret = param_set_uint(val, param);
+	if (ret || !pdata)
+		return ret;
+	spin_lock_irqsave(&pdata->dev->state_lock, flags);
+	if (is_key_scan_wanted())
+		start_key_scan();
+	spin_unlock_irqrestore(&pdata->dev->state_lock, flags);
+	return 0;
+}
+
+static const struct kernel_param_ops key_scan_ms_ops = {
+	.set = key_scan_ms_set,
+	.get = param_get_uint,
+};
 
 module_param(vfd_gpio_chip_name, charp, 0000);
 module_param_array(vfd_gpio_clk, uint, &vfd_gpio_clk_argc, 0000);
@@ -591,10 +1119,18 @@ module_param_array(vfd_gpio1, uint, &vfd_gpio1_argc, 0000);
 module_param_array(vfd_gpio2, uint, &vfd_gpio2_argc, 0000);
 module_param_array(vfd_gpio3, uint, &vfd_gpio3_argc, 0000);
 module_param_array(vfd_gpio_protocol, uint, &vfd_gpio_protocol_argc, 0000);
+module_param(vfd_hw_spi_speed, uint, 0000);
+module_param(vfd_sw_bus_speed, uint, 0000);
+module_param_array(vfd_eink_full_refresh, uint, &vfd_eink_full_refresh_argc, 0000);
 module_param_array(vfd_chars, uint, &vfd_chars_argc, 0000);
 module_param_array(vfd_dot_bits, uint, &vfd_dot_bits_argc, 0000);
 module_param_array(vfd_display_type, uint, &vfd_display_type_argc, 0000);
 module_param(vfd_display_auto_power, byte, 0000);
+module_param(vfd_max_fps, uint, 0644);
+module_param_cb(vfd_key_scan_ms, &key_scan_ms_ops, &vfd_key_scan_ms, 0644);
+module_param(vfd_key_debounce, byte, 0644);
+module_param(vfd_fbdev, byte, 0000);
+module_param_array(vfd_keymap, uint, &vfd_keymap_argc, 0000);
 
 static void print_param_debug(const char *label, int argc, unsigned int param[])
 {
@@ -710,9 +1246,11 @@ static int verify_module_params(struct vfd_dev *dev)
 	print_param_debug("vfd_chars:\t\t", vfd_chars_argc, vfd_chars);
 	print_param_debug("vfd_dot_bits:\t\t", vfd_dot_bits_argc, vfd_dot_bits);
 	print_param_debug("vfd_display_type:\t", vfd_display_type_argc, vfd_display_type);
+	print_param_debug("vfd_keymap:\t\t", vfd_keymap_argc, vfd_keymap);
 
 	dev->hw_protocol.protocol = (u_int8)vfd_gpio_protocol[0];
 	dev->hw_protocol.device_id = (u_int8)vfd_gpio_protocol[1];
+	dev->hw_protocol.speed_hz = vfd_hw_spi_speed;
 
 	gpiochip_find(NULL, enum_gpio_chips);
 	pr_dbg2("Detected gpio chips:\t%s.\n", gpio_chip_names);
@@ -780,6 +1318,60 @@ int request_pin(const char *name, struct vfd_pin *pin, unsigned char enable_skip
 	return ret;
 }
 
+static void register_key_input(struct platform_device *pdev)
+{
+	u32 keymap[KEYMAP_SIZE];
+	int i, count = 0;
+	struct input_dev *input;
+	unsigned long flags;
+
+	if (vfd_keymap_argc > 0) {
+		count = min(vfd_keymap_argc, KEYMAP_SIZE);
+		memcpy(keymap, vfd_keymap, count * sizeof(keymap[0]));
+	} else if (pdev->dev.of_node) {
+		struct property *keymap_prop = of_find_property(pdev->dev.of_node, MOD_NAME_KEYMAP, NULL);
+		if (keymap_prop && keymap_prop->value) {
+			count = min(keymap_prop->length / (int)sizeof(u32), KEYMAP_SIZE);
+			if (of_property_read_u32_array(pdev->dev.of_node, MOD_NAME_KEYMAP, keymap, count))
+				count = 0;
+		}
+	}
+	if (!count)
+		return;
+
+	input = devm_input_allocate_device(&pdev->dev);
+	if (!input) {
+		pr_error("can't allocate the key input device\n");
+		return;
+	}
+	input->name = "OpenVFD front panel keys";
+	input->phys = DEV_NAME "/input0";
+	input->id.bustype = BUS_HOST;
+	input->keycode = key_codes;
+	input->keycodesize = sizeof(key_codes[0]);
+	input->keycodemax = KEYMAP_SIZE;
+	__set_bit(EV_KEY, input->evbit);
+	memset(key_codes, 0, sizeof(key_codes));
+	for (i = 0; i < count; i++) {
+		unsigned int bit = keymap[i] >> 16, code = keymap[i] & 0xFFFF;
+		if (bit >= KEYMAP_SIZE || code == KEY_RESERVED || code > KEY_MAX) {
+			pr_error("%s entry #%d (0x%08X) is invalid, skipping.\n", MOD_NAME_KEYMAP, i, keymap[i]);
+			continue;
+		}
+		key_codes[bit] = code;
+		__set_bit(code, input->keybit);
+		pr_dbg2("key bit %u: code %u\n", bit, code);
+	}
+	if (input_register_device(input)) {
+		pr_error("can't register the key input device\n");
+		return;
+	}
+	spin_lock_irqsave(&pdata->dev->state_lock, flags);
+	key_input = input;
+	start_key_scan();
+	spin_unlock_irqrestore(&pdata->dev->state_lock, flags);
+}
+
 static int openvfd_driver_probe(struct platform_device *pdev)
 {
 	int state = -EINVAL;
@@ -811,6 +1403,10 @@ static int openvfd_driver_probe(struct platform_device *pdev)
 	}
 
 	pdata->dev->mutex = &mutex;
+	spin_lock_init(&pdata->dev->state_lock);
+	// jiffies doesn't start at 0, the first frame must not wait for the rate limit.
+	last_flush = jiffies - msecs_to_jiffies(1000);
+	init_waitqueue_head(&pdata->dev->kb_waitq);
 	pr_dbg2("Version: %s\n", OPENVFD_DRIVER_VERSION);
 	if (!verify_module_params(pdata->dev)) {
 		int i;
@@ -877,6 +1473,13 @@ static int openvfd_driver_probe(struct platform_device *pdev)
 			pdata->dev->dtb_active.display.type, pdata->dev->dtb_active.display.controller, pdata->dev->dtb_active.display.flags);
 	}
 
+	// Soft I2C / SPI clock, 0 keeps the rate each controller selects.
+	if (!vfd_sw_bus_speed)
+		of_property_read_u32(pdev->dev.of_node, MOD_NAME_SW_SPEED, &vfd_sw_bus_speed);
+	bus_timing_set_speed(vfd_sw_bus_speed);
+	pr_dbg2("vfd_sw_bus_speed:\t%u Hz\n", vfd_sw_bus_speed);
+	il3829_set_full_refresh(vfd_eink_full_refresh[0], vfd_eink_full_refresh[1]);
+
 	if (request_pin("gpio_clk", &pdata->dev->clk_pin, allow_skip_clk_dat_request))
 		goto get_gpio_req_fail;
 	if (request_pin("dat_pin", &pdata->dev->dat_pin, allow_skip_clk_dat_request))
@@ -895,12 +1498,14 @@ static int openvfd_driver_probe(struct platform_device *pdev)
 	pdata->dev->dtb_default = pdata->dev->dtb_active;
 	pdata->dev->brightness = 0xFF;
 
+	down_write(&config_rwsem);
 	mutex_lock(&mutex);
 	register_openvfd_driver();
 	kp = kzalloc(sizeof(struct kp) ,  GFP_KERNEL);
 	if (!kp) {
 		kfree(kp);
 		mutex_unlock(&mutex);
+		up_write(&config_rwsem);
 		return -ENOMEM;
 	}
 	kp->cdev.name = DEV_NAME;
@@ -909,6 +1514,7 @@ static int openvfd_driver_probe(struct platform_device *pdev)
 	if (ret < 0) {
 		kfree(kp);
 		mutex_unlock(&mutex);
+		up_write(&config_rwsem);
 		return ret;
 	}
 
@@ -943,6 +1549,10 @@ static int openvfd_driver_probe(struct platform_device *pdev)
 #endif
 
 	mutex_unlock(&mutex);
+	up_write(&config_rwsem);
+	register_key_input(pdev);
+	if (vfd_fbdev)
+		openvfd_fb_register(&pdev->dev, pdata->dev, &controller, vfd_max_fps);
 	return 0;
 
 	  get_gpio_req_fail:
@@ -972,6 +1582,14 @@ static int openvfd_driver_probe(struct platform_device *pdev)
 
 static int openvfd_driver_remove(struct platform_device *pdev)
 {
+	unsigned long flags;
+	openvfd_fb_unregister();
+	spin_lock_irqsave(&pdata->dev->state_lock, flags);
+	key_input = NULL;
+	spin_unlock_irqrestore(&pdata->dev->state_lock, flags);
+	hrtimer_cancel(&clock_timer);
+	cancel_delayed_work_sync(&key_scan_work);
+	discard_display_data();
 	set_power(0);
 #if defined(CONFIG_HAS_EARLYSUSPEND) || defined(CONFIG_AMLOGIC_LEGACY_EARLY_SUSPEND)
 	unregister_early_suspend(&openvfd_early_suspend);
@@ -1003,12 +1621,18 @@ static int openvfd_driver_remove(struct platform_device *pdev)
 static void openvfd_driver_shutdown(struct platform_device *dev)
 {
 	pr_dbg("openvfd_driver_shutdown");
+	hrtimer_cancel(&clock_timer);
+	cancel_delayed_work_sync(&key_scan_work);
+	discard_display_data();
 	set_power(0);
 }
 
 static int openvfd_driver_suspend(struct platform_device *dev, pm_message_t state)
 {
 	pr_dbg("openvfd_driver_suspend");
+	hrtimer_cancel(&clock_timer);
+	cancel_delayed_work_sync(&key_scan_work);
+	flush_delayed_work(&flush_work);
 	if (vfd_display_auto_power && controller && controller->power_suspend) {
 		controller->power_suspend();
 	}
@@ -1017,10 +1641,18 @@ static int openvfd_driver_suspend(struct platform_device *dev, pm_message_t stat
 
 static int openvfd_driver_resume(struct platform_device *dev)
 {
+	unsigned long flags;
 	pr_dbg("openvfd_driver_resume");
 	if (vfd_display_auto_power && controller && controller->power_resume) {
 		controller->power_resume();
 	}
+	spin_lock_irqsave(&pdata->dev->state_lock, flags);
+	if (is_key_scan_wanted())
+		start_key_scan();
+	spin_unlock_irqrestore(&pdata->dev->state_lock, flags);
+	mutex_lock(&mutex);
+	start_clock();
+	mutex_unlock(&mutex);
 	return 0;
 }
 
@@ -1048,16 +1680,29 @@ static struct platform_driver openvfd_driver = {
 
 static int __init openvfd_driver_init(void)
 {
+	int ret;
 	pr_dbg("OpenVFD Driver init.\n");
 	mutex_init(&mutex);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&clock_timer, clock_timer_handler, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+#else
+	hrtimer_init(&clock_timer, CLOCK_REALTIME, HRTIMER_MODE_ABS);
+	clock_timer.function = clock_timer_handler;
+#endif
+	ret = register_hw_spi_driver();
+	if (ret)
+		pr_error("failed to register the SPI driver (%d), hardware SPI is only available by bus number\n", ret);
 	return platform_driver_register(&openvfd_driver);
 }
 
 static void __exit openvfd_driver_exit(void)
 {
 	pr_dbg("OpenVFD Driver exit.\n");
-	mutex_destroy(&mutex);
 	platform_driver_unregister(&openvfd_driver);
+	unregister_hw_spi_driver();
+	release_hw_i2c();
+	release_gfx_mono_ctrl();
+	mutex_destroy(&mutex);
 }
 
 module_init(openvfd_driver_init);
@@ -5,6 +5,7 @@
 #include <linux/delay.h>
 #include <linux/slab.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #endif
 #include "glyphs.h"
 
@@ -50,7 +51,12 @@
 #define VFD_IOC_SDISPLAY_TYPE		_IOW(VFD_IOC_MAGIC,  9, int)
 #define VFD_IOC_SCHARS_ORDER		_IOW(VFD_IOC_MAGIC, 10, u_int8[7])
 #define VFD_IOC_USE_DTB_CONFIG		_IOW(VFD_IOC_MAGIC, 11, int)
-#define VFD_IOC_MAXNR			12
+#define VFD_IOC_GFB_INFO		_IOR(VFD_IOC_MAGIC, 12, struct vfd_fb_info)
+#define VFD_IOC_FB_FLUSH		_IOW(VFD_IOC_MAGIC, 13, struct vfd_fb_rect)
+#define VFD_IOC_SCLOCK			_IOW(VFD_IOC_MAGIC, 14, struct vfd_clock_config)
+#define VFD_IOC_GCLOCK			_IOR(VFD_IOC_MAGIC, 15, struct vfd_clock_config)
+#define VFD_IOC_GDELTA_VERSION		_IOR(VFD_IOC_MAGIC, 16, int)
+#define VFD_IOC_MAXNR			17
 
 #ifdef MODULE
 
@@ -65,6 +71,8 @@
 #define MOD_NAME_CHARS     "openvfd_chars"
 #define MOD_NAME_DOTS      "openvfd_dot_bits"
 #define MOD_NAME_TYPE      "openvfd_display_type"
+#define MOD_NAME_KEYMAP    "openvfd_keymap"
+#define MOD_NAME_SW_SPEED  "openvfd_sw_bus_speed"
 
 #endif
 
@@ -110,6 +118,7 @@ struct vfd_pin {
 struct vfd_protocol {
 	u_int8 protocol;
 	u_int8 device_id;
+	u_int32 speed_hz;
 };
 
 struct vfd_dev {
@@ -127,7 +136,8 @@ struct vfd_dev {
 	u_int8 mode;
 	u_int8 power;
 	u_int8 brightness;
-	struct mutex *mutex;
+	struct mutex *mutex;		/* Controller and bus access */
+	spinlock_t state_lock;		/* status_led_mask and the key state */
 	wait_queue_head_t kb_waitq;	/* read and write queues */
 	struct timer_list timer;
 	int key_respond_status;
@@ -135,6 +145,7 @@ struct vfd_dev {
 	u_int8 KeyPressCnt;
 	u_int8  key_fg;
 	u_int8  key_val;
+	u_int32 key_value;		/* Debounced key state from the key scan */
 	u_int8 status_led_mask;		/* Indicators mask */
 };
 
@@ -142,6 +153,19 @@ struct vfd_platform_data {
 	struct vfd_dev *dev;
 };
 
+static inline void vfd_update_status_led_mask(struct vfd_dev *dev, u_int8 clear_bits, u_int8 set_bits)
+{
+	unsigned long flags;
+	spin_lock_irqsave(&dev->state_lock, flags);
+	dev->status_led_mask = (dev->status_led_mask & ~clear_bits) | set_bits;
+	spin_unlock_irqrestore(&dev->state_lock, flags);
+}
+
+static inline void vfd_set_status_led(struct vfd_dev *dev, u_int8 bits, unsigned char state)
+{
+	vfd_update_status_led_mask(dev, bits, state ? bits : 0);
+}
+
 #endif
 
 struct vfd_display_data {
@@ -173,9 +197,95 @@ struct vfd_display_data {
 	char string_secondary[128];
 };
 
+/*
+ * Delta updates. Instead of a full struct vfd_display_data, a write may carry
+ * a struct vfd_delta_header followed by count records, each one a struct
+ * vfd_delta_record followed by length bytes, which replace the bytes at offset
+ * within the tagged field of the last frame written. Check the version with
+ * VFD_IOC_GDELTA_VERSION first, older drivers take the update as raw data.
+ */
+#define VFD_DELTA_MAGIC			"OVFD"
+#define VFD_DELTA_VERSION		1
+
+enum {
+	VFD_DELTA_MODE,
+	VFD_DELTA_COLON,
+	VFD_DELTA_TEMPERATURE,
+	VFD_DELTA_TIME_DATE,
+	VFD_DELTA_TIME_SECONDARY,
+	VFD_DELTA_CHANNEL,
+	VFD_DELTA_STRING_MAIN,
+	VFD_DELTA_STRING_SECONDARY,
+	VFD_DELTA_MAX,
+};
+
+struct vfd_delta_header {
+	u_int8 magic[4];
+	u_int8 version;
+	u_int8 count;
+	u_int16 _reserved;
+};
+
+struct vfd_delta_record {
+	u_int8 tag;
+	u_int8 length;
+	u_int16 offset;
+};
+
+/*
+ * Graphical controllers expose their frame buffer through mmap() on the
+ * device. The buffer is in controller RAM layout, 1 = pixel on:
+ *   VFD_FB_FORMAT_VLSB - rows of line_length bytes, each byte is a column of
+ *                        8 vertical pixels, LSB on top (SSD1306, SH1106, PCD8544).
+ *   VFD_FB_FORMAT_HMSB - one row per pixel line, each byte is 8 horizontal
+ *                        pixels, MSB on the left (IL3829).
+ * Changes are sent to the display with VFD_IOC_FB_FLUSH, which takes the
+ * damaged area in pixels. While the buffer is mapped, VFD_IOC_SDISPLAY_TYPE
+ * and VFD_IOC_USE_DTB_CONFIG fail with EBUSY.
+ */
+enum {
+	VFD_FB_FORMAT_VLSB,
+	VFD_FB_FORMAT_HMSB,
+};
+
+struct vfd_fb_info {
+	u_int16 width;
+	u_int16 height;
+	u_int16 line_length;
+	u_int16 rows;
+	u_int16 format;
+	u_int16 _reserved;
+	u_int32 size;		/* Page aligned, 64K pages don't fit 16 bits */
+};
+
+struct vfd_fb_rect {
+	u_int16 x;
+	u_int16 y;
+	u_int16 width;
+	u_int16 height;
+};
+
+/*
+ * Autonomous clock. While enabled, the driver draws the clock (or the date)
+ * by itself on every half second edge. Writing display data disables it.
+ */
+enum {
+	VFD_CLOCK_FLAG_12H	= 0x01,
+	VFD_CLOCK_FLAG_DATE	= 0x02,
+};
+
+struct vfd_clock_config {
+	u_int8 enabled;
+	u_int8 flags;
+	u_int8 date_format;		/* time_secondary._reserved in DISPLAY_MODE_DATE */
+	u_int8 _reserved;
+	int utc_offset;			/* Local time offset from UTC, in seconds */
+};
+
 enum {
 	PROTOCOL_NONE,
 	PROTOCOL_I2C,
+	PROTOCOL_SPI,
 	PROTOCOL_MAX
 };
 
@@ -0,0 +1,269 @@
+/*
+ * Open VFD Driver - fbdev interface for the graphical controllers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fb.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/bitrev.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include "openvfd_fb.h"
+
+/*
+ * The fbdev buffer is 1bpp packed, leftmost pixel in the LSB, 1 = pixel on.
+ * Pages written through mmap() are reported by deferred I/O, drawing done by
+ * the kernel (fbcon, write()) is accumulated into a line range. Either way
+ * the affected lines are converted into the controller frame buffer and
+ * flushed, which only sends the bytes that actually changed.
+ */
+
+static struct fb_info *fb_info = NULL;
+static struct vfd_dev *dev = NULL;
+static struct controller_interface **controller = NULL;
+static unsigned char *vmem = NULL;
+static DEFINE_SPINLOCK(damage_lock);
+static unsigned int damage_y1 = 0;
+static unsigned int damage_y2 = 0;
+static unsigned char is_damaged = 0;
+static unsigned char is_registered = 0;
+static void damage_work_handler(struct work_struct *work);
+static DECLARE_DELAYED_WORK(damage_work, damage_work_handler);
+
+static void convert_lines(unsigned char *fb, const struct vfd_fb_info *ctrl_info, unsigned int y1, unsigned int y2)
+{
+	const unsigned int line_length = fb_info->fix.line_length;
+	const unsigned int width = min_t(unsigned int, fb_info->var.xres, ctrl_info->width);
+	unsigned int x, y, k;
+
+	if (ctrl_info->format == VFD_FB_FORMAT_HMSB) {
+		for (y = y1; y <= y2; y++)
+			for (x = 0; x < DIV_ROUND_UP(width, 8); x++)
+				fb[y * ctrl_info->line_length + x] = bitrev8(vmem[y * line_length + x]);
+		return;
+	}
+
+	for (y = y1 & ~7U; y <= y2; y += 8) {
+		unsigned char *dst = &fb[(y / 8) * ctrl_info->line_length];
+		for (x = 0; x < width; x++) {
+			unsigned char data = 0;
+			for (k = 0; k < 8 && y + k < fb_info->var.yres; k++)
+				data |= ((vmem[(y + k) * line_length + x / 8] >> (x % 8)) & 0x01) << k;
+			dst[x] = data;
+		}
+	}
+}
+
+static void update_lines(unsigned int y1, unsigned int y2)
+{
+	struct vfd_fb_info ctrl_info;
+	struct vfd_fb_rect rect;
+	unsigned char *fb = NULL;
+
+	mutex_lock(dev->mutex);
+	if ((*controller)->get_framebuffer)
+		fb = (*controller)->get_framebuffer(&ctrl_info);
+	// The geometry is fixed at registration, clip if the display type was changed since.
+	if (fb) {
+		y2 = min_t(unsigned int, y2, min_t(unsigned int, fb_info->var.yres, ctrl_info.height) - 1);
+		if (y1 <= y2) {
+			convert_lines(fb, &ctrl_info, y1, y2);
+			rect.x = 0;
+			rect.y = y1;
+			rect.width = ctrl_info.width;
+			rect.height = y2 - y1 + 1;
+			(*controller)->flush_framebuffer(&rect);
+		}
+	}
+	mutex_unlock(dev->mutex);
+}
+
+static void damage_work_handler(struct work_struct *work)
+{
+	unsigned long flags;
+	unsigned int y1, y2;
+	unsigned char damaged;
+
+	spin_lock_irqsave(&damage_lock, flags);
+	damaged = is_damaged;
+	y1 = damage_y1;
+	y2 = damage_y2;
+	is_damaged = 0;
+	spin_unlock_irqrestore(&damage_lock, flags);
+	if (damaged)
+		update_lines(y1, y2);
+}
+
+static void damage_lines(unsigned int y, unsigned int height)
+{
+	unsigned long flags;
+	if (!height)
+		return;
+
+	spin_lock_irqsave(&damage_lock, flags);
+	if (!is_damaged) {
+		damage_y1 = y;
+		damage_y2 = y + height - 1;
+		is_damaged = 1;
+	} else {
+		damage_y1 = min(damage_y1, y);
+		damage_y2 = max(damage_y2, y + height - 1);
+	}
+	spin_unlock_irqrestore(&damage_lock, flags);
+	schedule_delayed_work(&damage_work, fb_info->fbdefio->delay);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)
+static void openvfd_fb_deferred_io(struct fb_info *info, struct list_head *pagereflist)
+{
+	struct fb_deferred_io_pageref *pageref;
+	unsigned int y1 = ~0U, y2 = 0;
+	list_for_each_entry(pageref, pagereflist, list) {
+		y1 = min(y1, (unsigned int)(pageref->offset / info->fix.line_length));
+		y2 = max(y2, (unsigned int)((pageref->offset + PAGE_SIZE - 1) / info->fix.line_length));
+	}
+	if (y1 <= y2)
+		update_lines(y1, y2);
+}
+#else
+static void openvfd_fb_deferred_io(struct fb_info *info, struct list_head *pagelist)
+{
+	struct page *page;
+	unsigned int y1 = ~0U, y2 = 0;
+	list_for_each_entry(page, pagelist, lru) {
+		y1 = min(y1, (unsigned int)((page->index << PAGE_SHIFT) / info->fix.line_length));
+		y2 = max(y2, (unsigned int)(((page->index << PAGE_SHIFT) + PAGE_SIZE - 1) / info->fix.line_length));
+	}
+	if (y1 <= y2)
+		update_lines(y1, y2);
+}
+#endif
+
+static struct fb_deferred_io openvfd_fb_defio = {
+	.delay = HZ / 30,
+	.deferred_io = openvfd_fb_deferred_io,
+};
+
+static ssize_t openvfd_fb_write(struct fb_info *info, const char __user *buf, size_t count, loff_t *ppos)
+{
+	loff_t pos = *ppos;
+	ssize_t ret = fb_sys_write(info, buf, count, ppos);
+	if (ret > 0)
+		damage_lines(pos / info->fix.line_length, (pos + ret - 1) / info->fix.line_length - pos / info->fix.line_length + 1);
+	return ret;
+}
+
+static void openvfd_fb_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
+{
+	sys_fillrect(info, rect);
+	damage_lines(rect->dy, rect->height);
+}
+
+static void openvfd_fb_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+{
+	sys_copyarea(info, area);
+	damage_lines(area->dy, area->height);
+}
+
+static void openvfd_fb_imageblit(struct fb_info *info, const struct fb_image *image)
+{
+	sys_imageblit(info, image);
+	damage_lines(image->dy, image->height);
+}
+
+static struct fb_ops openvfd_fb_ops = {
+	.owner = THIS_MODULE,
+	.fb_read = fb_sys_read,
+	.fb_write = openvfd_fb_write,
+	.fb_fillrect = openvfd_fb_fillrect,
+	.fb_copyarea = openvfd_fb_copyarea,
+	.fb_imageblit = openvfd_fb_imageblit,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)
+	.fb_mmap = fb_deferred_io_mmap,
+#endif
+};
+
+int openvfd_fb_register(struct device *parent, struct vfd_dev *_dev, struct controller_interface **_controller, unsigned int fps)
+{
+	struct vfd_fb_info ctrl_info;
+	unsigned int line_length, size;
+	int ret;
+
+	if (fb_info)
+		return 0;
+	mutex_lock(_dev->mutex);
+	if (!(*_controller)->get_framebuffer || !(*_controller)->get_framebuffer(&ctrl_info)) {
+		mutex_unlock(_dev->mutex);
+		pr_dbg2("fbdev: the display controller has no frame buffer\n");
+		return -ENODEV;
+	}
+	mutex_unlock(_dev->mutex);
+
+	line_length = DIV_ROUND_UP(ctrl_info.width, 8);
+	size = PAGE_ALIGN(line_length * ctrl_info.height);
+	vmem = vzalloc(size);
+	if (!vmem)
+		return -ENOMEM;
+	fb_info = framebuffer_alloc(0, parent);
+	if (!fb_info) {
+		vfree(vmem);
+		vmem = NULL;
+		return -ENOMEM;
+	}
+
+	dev = _dev;
+	controller = _controller;
+	scnprintf(fb_info->fix.id, sizeof(fb_info->fix.id), "%s", DEV_NAME);
+	fb_info->fix.type = FB_TYPE_PACKED_PIXELS;
+	fb_info->fix.visual = FB_VISUAL_MONO10;
+	fb_info->fix.accel = FB_ACCEL_NONE;
+	fb_info->fix.line_length = line_length;
+	fb_info->fix.smem_len = size;
+	fb_info->var.xres = fb_info->var.xres_virtual = ctrl_info.width;
+	fb_info->var.yres = fb_info->var.yres_virtual = ctrl_info.height;
+	fb_info->var.bits_per_pixel = 1;
+	fb_info->var.red.length = fb_info->var.green.length = fb_info->var.blue.length = 1;
+	fb_info->var.nonstd = 0;
+	fb_info->fbops = &openvfd_fb_ops;
+	fb_info->flags = FBINFO_VIRTFB;
+	fb_info->screen_base = (char __iomem *)vmem;
+	fb_info->screen_size = size;
+	fb_info->fix.smem_start = 0;
+	if (fps)
+		openvfd_fb_defio.delay = max(HZ / fps, 1U);
+	fb_info->fbdefio = &openvfd_fb_defio;
+	fb_deferred_io_init(fb_info);
+
+	ret = register_framebuffer(fb_info);
+	if (ret) {
+		pr_error("fbdev: failed to register framebuffer (%d)\n", ret);
+		openvfd_fb_unregister();
+		return ret;
+	}
+	is_registered = 1;
+	pr_dbg2("fbdev: fb%d registered, %ux%u\n", fb_info->node, ctrl_info.width, ctrl_info.height);
+	return 0;
+}
+
+void openvfd_fb_unregister(void)
+{
+	if (!fb_info)
+		return;
+	if (is_registered)
+		unregister_framebuffer(fb_info);
+	is_registered = 0;
+	cancel_delayed_work_sync(&damage_work);
+	fb_deferred_io_cleanup(fb_info);
+	framebuffer_release(fb_info);
+	vfree(vmem);
+	fb_info = NULL;
+	vmem = NULL;
+}
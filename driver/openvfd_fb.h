@@ -0,0 +1,10 @@
+#ifndef __OPENVFD_FB_H__
+#define __OPENVFD_FB_H__
+
+#include "openvfd_drv.h"
+#include "controllers/controller.h"
+
+int openvfd_fb_register(struct device *parent, struct vfd_dev *dev, struct controller_interface **controller, unsigned int fps);
+void openvfd_fb_unregister(void);
+
+#endif
@@ -0,0 +1,55 @@
+#include <linux/gpio.h>
+#include <linux/ktime.h>
+#include "bus_timing.h"
+
+/*
+ * Bit timing of the soft protocols. Every half clock period is a GPIO call
+ * followed by a delay, so the delay is the half period less the measured
+ * cost of a GPIO call on the bus pins. The half period is either set by an
+ * explicit bus frequency, or is the udelay() value the controller asks for,
+ * which then is the actual half period instead of a lower bound.
+ */
+
+static unsigned long bus_speed_hz = 0;
+
+void bus_timing_set_speed(unsigned long speed_hz)
+{
+	bus_speed_hz = speed_hz;
+}
+
+unsigned long bus_timing_get_speed(void)
+{
+	return bus_speed_hz;
+}
+
+/*
+ * Average cost of a GPIO call on an idle bus pin. level < 0 measures the
+ * release of an open drain line (the pin must already be released), any
+ * other level the write of the level the pin is already driven to, so the
+ * bus does not see an edge. The fastest round is used, since preemption
+ * or an interrupt may only make the calls look slower.
+ */
+unsigned int bus_timing_gpio_cost(unsigned gpio, int level)
+{
+	unsigned long elapsed, best = ~0UL;
+	u64 start;
+	int i, j;
+	for (i = 0; i < BUS_TIMING_ROUNDS; i++) {
+		start = ktime_get_ns();
+		for (j = 0; j < BUS_TIMING_SAMPLES; j++) {
+			if (level < 0)
+				gpio_direction_input(gpio);
+			else
+				gpio_set_value(gpio, level);
+		}
+		elapsed = (unsigned long)(ktime_get_ns() - start);
+		best = min(best, elapsed);
+	}
+	return best / BUS_TIMING_SAMPLES;
+}
+
+unsigned long bus_timing_delay_ns(unsigned long delay_us, unsigned int gpio_cost_ns)
+{
+	unsigned long half_period_ns = bus_speed_hz ? DIV_ROUND_UP(NSEC_PER_SEC / 2, bus_speed_hz) : delay_us * NSEC_PER_USEC;
+	return half_period_ns > gpio_cost_ns ? half_period_ns - gpio_cost_ns : 0;
+}
@@ -0,0 +1,12 @@
+#ifndef __BUS_TIMING_H__
+#define __BUS_TIMING_H__
+
+#define BUS_TIMING_ROUNDS	4
+#define BUS_TIMING_SAMPLES	16
+
+void bus_timing_set_speed(unsigned long speed_hz);
+unsigned long bus_timing_get_speed(void);
+unsigned int bus_timing_gpio_cost(unsigned gpio, int level);
+unsigned long bus_timing_delay_ns(unsigned long delay_us, unsigned int gpio_cost_ns);
+
+#endif
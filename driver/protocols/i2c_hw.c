@@ -9,12 +9,16 @@
 #define LOW	0
 #define HIGH	1
 
+#define I2C_HW_MIN_BUFFER	256
+#define I2C_HW_MAX_BATCH	16
+
 static unsigned char i2c_hw_read_cmd_data(const unsigned char *cmd, unsigned short cmd_length, unsigned char *data, unsigned short data_length);
 static unsigned char i2c_hw_read_data(unsigned char *data, unsigned short length);
 static unsigned char i2c_hw_read_byte(unsigned char *bdata);
 static unsigned char i2c_hw_write_cmd_data(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length);
 static unsigned char i2c_hw_write_data(const unsigned char *data, unsigned short length);
 static unsigned char i2c_hw_write_byte(unsigned char bdata);
+static unsigned char i2c_hw_write_cmd_data_batch(const struct protocol_xfer *xfers, unsigned short count);
 
 static struct protocol_interface i2c_hw_interface = {
 	.read_cmd_data = i2c_hw_read_cmd_data,
@@ -23,6 +27,7 @@ static struct protocol_interface i2c_hw_interface = {
 	.write_cmd_data = i2c_hw_write_cmd_data,
 	.write_data = i2c_hw_write_data,
 	.write_byte = i2c_hw_write_byte,
+	.write_cmd_data_batch = i2c_hw_write_cmd_data_batch,
 	.protocol_type = PROTOCOL_TYPE_I2C
 };
 
@@ -38,6 +43,28 @@ static union address i2c_address = { 0 };
 static struct i2c_adapter *i2c;
 static unsigned char use_address = 0;
 static unsigned short long_address_flag = 0;
+static unsigned char use_nostart = 0;		// Adapter can continue a message without a repeated START.
+/*
+ * Writes are staged in a kmalloc()ed buffer, the controllers hand us static
+ * arrays which live in module memory and are not safe for DMA. The buffer is
+ * allocated once at init and only grows, so the write path does not allocate.
+ */
+static unsigned char *xfer_buf = NULL;
+static unsigned int xfer_buf_size = 0;
+
+static unsigned char *i2c_hw_reserve(unsigned int length)
+{
+	if (length > xfer_buf_size) {
+		unsigned int size = max_t(unsigned int, length, I2C_HW_MIN_BUFFER);
+		unsigned char *buf = kmalloc(size, GFP_KERNEL);
+		if (!buf)
+			return NULL;
+		kfree(xfer_buf);
+		xfer_buf = buf;
+		xfer_buf_size = size;
+	}
+	return xfer_buf;
+}
 
 static unsigned char i2c_hw_test_connection(void)
 {
@@ -47,9 +74,12 @@ static unsigned char i2c_hw_test_connection(void)
 struct protocol_interface *init_hw_i2c(unsigned short _address, unsigned char _device_id)
 {
 	struct protocol_interface *i2c_hw_ptr = NULL;
+	if (i2c)
+		i2c_put_adapter(i2c);
 	i2c = i2c_get_adapter(_device_id);
 	if (i2c) {
 		pr_dbg2("Found I2C-%d adapter: %s\n", _device_id , i2c->name);
+		use_nostart = i2c_check_functionality(i2c, I2C_FUNC_NOSTART) ? 1 : 0;
 		if (_address) {
 			use_address = 1;
 			long_address_flag = _address > 0xFF ? I2C_M_TEN : 0;				// A valid 10-bit address always starts with b11110.
@@ -57,7 +87,7 @@ struct protocol_interface *init_hw_i2c(unsigned short _address, unsigned char _d
 		} else {
 			use_address = 0;
 		}
-		if (!i2c_hw_test_connection()) {
+		if (i2c_hw_reserve(I2C_HW_MIN_BUFFER) && !i2c_hw_test_connection()) {
 			i2c_hw_ptr = &i2c_hw_interface;
 			pr_dbg2("HW I2C interface intialized (address = 0x%04X%s)\n", i2c_address.value, !use_address ? " (N/A)" : "");
 		} else {
@@ -69,20 +99,40 @@ struct protocol_interface *init_hw_i2c(unsigned short _address, unsigned char _d
 	return i2c_hw_ptr;
 }
 
-static int i2c_hw_writereg(unsigned char *data, unsigned short size)
+void release_hw_i2c(void)
 {
-	int ret;
-	struct i2c_msg msg[1] = {
+	if (i2c)
+		i2c_put_adapter(i2c);
+	i2c = NULL;
+	kfree(xfer_buf);
+	xfer_buf = NULL;
+	xfer_buf_size = 0;
+}
+
+static int i2c_hw_writereg(unsigned char *data, unsigned short cmd_length, unsigned short data_length)
+{
+	int ret, count = 1;
+	struct i2c_msg msg[2] = {
 			{
 				.addr = i2c_address.value,
 				.flags = long_address_flag,
 				.buf = data,
-				.len = size,
+				.len = cmd_length + data_length,
 			}
 	};
 
-	ret = i2c_transfer(i2c, msg, 1);
-	if (ret == 1) {
+	// Send the payload as a continuation of the command, where the adapter allows it.
+	if (use_nostart && cmd_length && data_length) {
+		msg[0].len = cmd_length;
+		msg[1].addr = i2c_address.value;
+		msg[1].flags = long_address_flag | I2C_M_NOSTART;
+		msg[1].buf = data + cmd_length;
+		msg[1].len = data_length;
+		count = 2;
+	}
+
+	ret = i2c_transfer(i2c, msg, count);
+	if (ret == count) {
 		ret = 0;
 	} else {
 		dev_warn(&i2c->dev, "i2c wr failed=%d", ret);
@@ -135,19 +185,20 @@ static unsigned char i2c_hw_read_byte(unsigned char *bdata)
 
 static unsigned char i2c_hw_write_cmd_data(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length)
 {
-	unsigned char status = 0;
-	unsigned short total_length = max(cmd_length + data_length, 4);
-	char *buf = kmalloc(total_length, GFP_KERNEL);
-
+	unsigned char *buf = i2c_hw_reserve(cmd_length + data_length);
+
+	if (!buf)
+		return -ENOMEM;
+	if (!cmd)
+		cmd_length = 0;
+	if (!data)
+		data_length = 0;
 	if (cmd)
 		memcpy(buf, cmd, cmd_length);
-
 	if (data)
 		memcpy(buf + cmd_length, data, data_length);
 
-	status = i2c_hw_writereg(buf, cmd_length + data_length);
-	kfree(buf);
-	return status;
+	return i2c_hw_writereg(buf, cmd_length, data_length);
 }
 
 static unsigned char i2c_hw_write_data(const unsigned char *data, unsigned short length)
@@ -159,3 +210,44 @@ static unsigned char i2c_hw_write_byte(unsigned char bdata)
 {
 	return i2c_hw_write_cmd_data(NULL, 0, &bdata, 1);
 }
+
+static unsigned char i2c_hw_write_cmd_data_batch(const struct protocol_xfer *xfers, unsigned short count)
+{
+	struct i2c_msg msgs[I2C_HW_MAX_BATCH];
+	unsigned int length, i, n;
+	unsigned char *buf;
+	int ret;
+
+	// Each transfer is a message of its own, the adapter joins them with repeated STARTs.
+	while (count) {
+		n = min_t(unsigned int, count, I2C_HW_MAX_BATCH);
+		for (i = 0, length = 0; i < n; i++)
+			length += (xfers[i].cmd ? xfers[i].cmd_length : 0) + (xfers[i].data ? xfers[i].data_length : 0);
+		buf = i2c_hw_reserve(length);
+		if (!buf)
+			return -ENOMEM;
+		for (i = 0; i < n; i++) {
+			msgs[i].addr = i2c_address.value;
+			msgs[i].flags = long_address_flag;
+			msgs[i].buf = buf;
+			msgs[i].len = 0;
+			if (xfers[i].cmd) {
+				memcpy(buf + msgs[i].len, xfers[i].cmd, xfers[i].cmd_length);
+				msgs[i].len += xfers[i].cmd_length;
+			}
+			if (xfers[i].data) {
+				memcpy(buf + msgs[i].len, xfers[i].data, xfers[i].data_length);
+				msgs[i].len += xfers[i].data_length;
+			}
+			buf += msgs[i].len;
+		}
+		ret = i2c_transfer(i2c, msgs, n);
+		if (ret != (int)n) {
+			dev_warn(&i2c->dev, "i2c wr failed=%d", ret);
+			return -EREMOTEIO;
+		}
+		xfers += n;
+		count -= n;
+	}
+	return 0;
+}
@@ -4,5 +4,6 @@
 #include "protocol.h"
 
 struct protocol_interface *init_hw_i2c(unsigned short _address, unsigned char _device_id);
+void release_hw_i2c(void);
 
 #endif
@@ -1,17 +1,21 @@
 #include <linux/gpio.h>
 #include <linux/version.h>
 #include "i2c_sw.h"
+#include "bus_timing.h"
 
 #define pr_dbg2(args...) printk(KERN_DEBUG "OpenVFD: " args)
 #define LOW	0
 #define HIGH	1
 
+#define I2C_SW_STRETCH_LEARN	32	// Consecutive ACKs without clock stretching before SCL is no longer checked.
+
 static unsigned char i2c_sw_read_cmd_data(const unsigned char *cmd, unsigned short cmd_length, unsigned char *data, unsigned short data_length);
 static unsigned char i2c_sw_read_data(unsigned char *data, unsigned short length);
 static unsigned char i2c_sw_read_byte(unsigned char *bdata);
 static unsigned char i2c_sw_write_cmd_data(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length);
 static unsigned char i2c_sw_write_data(const unsigned char *data, unsigned short length);
 static unsigned char i2c_sw_write_byte(unsigned char bdata);
+static unsigned char i2c_sw_write_cmd_data_batch(const struct protocol_xfer *xfers, unsigned short count);
 
 static struct protocol_interface i2c_sw_interface = {
 	.read_cmd_data = i2c_sw_read_cmd_data,
@@ -20,6 +24,7 @@ static struct protocol_interface i2c_sw_interface = {
 	.write_cmd_data = i2c_sw_write_cmd_data,
 	.write_data = i2c_sw_write_data,
 	.write_byte = i2c_sw_write_byte,
+	.write_cmd_data_batch = i2c_sw_write_cmd_data_batch,
 	.protocol_type = PROTOCOL_TYPE_I2C
 };
 
@@ -36,11 +41,16 @@ static void i2c_sw_stop_condition(void);
 static union address i2c_sw_address = { 0 };
 static unsigned char use_address = 0;
 static unsigned char long_address = 0;
-static unsigned long i2c_sw_delay = I2C_DELAY_100KHz;
+static unsigned long i2c_sw_delay_ns = I2C_DELAY_100KHz * 1000;
 static unsigned char lsb_first = 0;
 static unsigned short clk_stretch_timeout = 0;
+static unsigned short clean_acks = 0;
+static struct i2c_sw_stats stats = { 0 };
 static struct vfd_pin pin_scl = { 0 };
 static struct vfd_pin pin_sda = { 0 };
+// Last state set on SCL / SDA (LOW, HIGH = released, -1 = unknown), used to skip redundant direction changes.
+static signed char scl_state = -1;
+static signed char sda_state = -1;
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,0,0)
 inline void gpio_set_pullup(unsigned gpio, int value)
@@ -69,19 +79,23 @@ struct protocol_interface *init_sw_i2c(unsigned short _address, unsigned char _l
 		lsb_first = _lsb_first;
 		pin_scl = _pin_scl;
 		pin_sda = _pin_sda;
-		i2c_sw_delay = _i2c_sw_delay;
 		clk_stretch_timeout = _clock_stretch_support ? (10 * _i2c_sw_delay) : 0;
+		clean_acks = 0;
+		memset(&stats, 0, sizeof(stats));
+		scl_state = sda_state = -1;
 		if (_pin_scl.flags.bits.pullup_on)
 			gpio_set_pullup(_pin_scl.pin, 1);
 		if (_pin_sda.flags.bits.pullup_on)
 			gpio_set_pullup(_pin_sda.pin, 1);
 		i2c_sw_stop_condition();
+		// Both lines are released now, so the cost of releasing SDA can be measured without disturbing the bus.
+		i2c_sw_delay_ns = bus_timing_delay_ns(_i2c_sw_delay, bus_timing_gpio_cost(pin_sda.pin, -1));
 		if (!test_connection)
 			test_connection = i2c_sw_test_connection;
 		if (!test_connection(&i2c_sw_interface)) {
 			i2c_sw_ptr = &i2c_sw_interface;
-			pr_dbg2("SW I2C interface intialized (address = 0x%04X%s, %s mode, pull-ups %s)\n", i2c_sw_address.value, !use_address ? " (N/A)" : "",
-				lsb_first ? "LSB" : "MSB", _pin_scl.flags.bits.pullup_on ? "on" : "off" );
+			pr_dbg2("SW I2C interface intialized (address = 0x%04X%s, %s mode, pull-ups %s, %lu ns delay)\n", i2c_sw_address.value, !use_address ? " (N/A)" : "",
+				lsb_first ? "LSB" : "MSB", _pin_scl.flags.bits.pullup_on ? "on" : "off", i2c_sw_delay_ns);
 		} else {
 			pr_dbg2("SW I2C interface failed to intialize. Could not establish communication with I2C slave\n");
 		}
@@ -91,56 +105,96 @@ struct protocol_interface *init_sw_i2c(unsigned short _address, unsigned char _l
 	return i2c_sw_ptr;
 }
 
-static inline void gpio_set_pin_low(const struct vfd_pin *pin)
+static inline void gpio_set_pin_low(const struct vfd_pin *pin, signed char *state)
 {
-	gpio_direction_output(pin->pin, LOW);
+	if (*state != LOW) {
+		gpio_direction_output(pin->pin, LOW);
+		*state = LOW;
+	}
 }
 
-static inline void gpio_set_pin_high(const struct vfd_pin *pin)
+static inline void gpio_set_pin_high(const struct vfd_pin *pin, signed char *state)
 {
-	if (pin->flags.bits.kick_high)
-		gpio_direction_output(pin->pin, HIGH);
-	gpio_direction_input(pin->pin);
+	if (*state != HIGH) {
+		if (pin->flags.bits.kick_high)
+			gpio_direction_output(pin->pin, HIGH);
+		gpio_direction_input(pin->pin);
+		*state = HIGH;
+	}
 }
 
 static void i2c_sw_start_condition(void)
 {
-	gpio_set_pin_low(&pin_sda);
-	udelay(i2c_sw_delay);
-	gpio_set_pin_low(&pin_scl);
-	udelay(i2c_sw_delay);
+	gpio_set_pin_low(&pin_sda, &sda_state);
+	ndelay(i2c_sw_delay_ns);
+	gpio_set_pin_low(&pin_scl, &scl_state);
+	ndelay(i2c_sw_delay_ns);
+}
+
+static void i2c_sw_restart_condition(void)
+{
+	gpio_set_pin_high(&pin_sda, &sda_state);
+	ndelay(i2c_sw_delay_ns);
+	gpio_set_pin_high(&pin_scl, &scl_state);
+	ndelay(i2c_sw_delay_ns);
+	i2c_sw_start_condition();
 }
 
 static void i2c_sw_stop_condition(void)
 {
-	gpio_set_pin_high(&pin_scl);
-	udelay(i2c_sw_delay);
-	gpio_set_pin_high(&pin_sda);
-	udelay(i2c_sw_delay);
-	udelay(i2c_sw_delay);
+	gpio_set_pin_high(&pin_scl, &scl_state);
+	ndelay(i2c_sw_delay_ns);
+	gpio_set_pin_high(&pin_sda, &sda_state);
+	ndelay(i2c_sw_delay_ns);
+	ndelay(i2c_sw_delay_ns);
+}
+
+void i2c_sw_get_stats(struct i2c_sw_stats *_stats)
+{
+	*_stats = stats;
 }
 
+/*
+ * Slaves which support clock stretching may hold SCL low in the ACK phase.
+ * SCL is checked until the slave went I2C_SW_STRETCH_LEARN ACKs without
+ * stretching, after that only SDA is sampled. A NACK or a stretch timeout
+ * may mean the slave did stretch after all, so both go back to checking.
+ */
 static inline unsigned char i2c_sw_ack(void)
 {
-	unsigned char ret = 1, scl = 1;
+	unsigned char ret = 1;
 	unsigned short timeout = clk_stretch_timeout;
-	gpio_set_pin_low(&pin_scl);
-	gpio_set_pin_high(&pin_sda);
-	udelay(i2c_sw_delay);
-	gpio_set_pin_high(&pin_scl);
-	udelay(i2c_sw_delay);
+	gpio_set_pin_low(&pin_scl, &scl_state);
+	gpio_set_pin_high(&pin_sda, &sda_state);
+	ndelay(i2c_sw_delay_ns);
+	gpio_set_pin_high(&pin_scl, &scl_state);
+	ndelay(i2c_sw_delay_ns);
+	stats.acks++;
 	if (timeout) {
-		do {
-			scl = gpio_get_value(pin_scl.pin) ? 1 : 0;
-			udelay(1);
-		} while (!scl && timeout--);
+		if (clean_acks >= I2C_SW_STRETCH_LEARN) {
+			stats.fast_acks++;
+		} else if (gpio_get_value(pin_scl.pin)) {
+			clean_acks++;
+		} else {
+			stats.stretches++;
+			clean_acks = 0;
+			do {
+				udelay(1);
+			} while (!gpio_get_value(pin_scl.pin) && --timeout);
+			if (!timeout)
+				stats.timeouts++;
+		}
 		ret = gpio_get_value(pin_sda.pin) ? 1 : 0;
+		if (ret) {
+			stats.nacks++;
+			clean_acks = 0;
+		}
 	} else {
 		ret = 0;
 	}
-	gpio_set_pin_low(&pin_scl);
-	gpio_set_pin_low(&pin_sda);
-	udelay(i2c_sw_delay);
+	gpio_set_pin_low(&pin_scl, &scl_state);
+	gpio_set_pin_low(&pin_sda, &sda_state);
+	ndelay(i2c_sw_delay_ns);
 	return ret;
 }
 
@@ -148,16 +202,16 @@ static unsigned char i2c_sw_write_raw_byte(unsigned char data)
 {
 	unsigned char i = 8;
 	unsigned char mask = lsb_first ? 0x01 : 0x80;
-	gpio_set_pin_low(&pin_scl);
+	gpio_set_pin_low(&pin_scl, &scl_state);
 	while (i--) {
 		if (data & mask)
-			gpio_set_pin_high(&pin_sda);
+			gpio_set_pin_high(&pin_sda, &sda_state);
 		else
-			gpio_set_pin_low(&pin_sda);
-		udelay(i2c_sw_delay);
-		gpio_set_pin_high(&pin_scl);
-		udelay(i2c_sw_delay);
-		gpio_set_pin_low(&pin_scl);
+			gpio_set_pin_low(&pin_sda, &sda_state);
+		ndelay(i2c_sw_delay_ns);
+		gpio_set_pin_high(&pin_scl, &scl_state);
+		ndelay(i2c_sw_delay_ns);
+		gpio_set_pin_low(&pin_scl, &scl_state);
 		if (lsb_first)
 			data >>= 1;
 		else
@@ -171,18 +225,18 @@ static unsigned char i2c_sw_read_raw_byte(unsigned char *data)
 	unsigned char i = 8;
 	unsigned char mask = lsb_first ? 0x80 : 0x01;
 	*data = 0;
-	gpio_set_pin_high(&pin_sda);
+	gpio_set_pin_high(&pin_sda, &sda_state);
 	while (i--) {
 		if (lsb_first)
 			*data >>= 1;
 		else
 			*data <<= 1;
-		gpio_set_pin_high(&pin_scl);
-		udelay(i2c_sw_delay);
+		gpio_set_pin_high(&pin_scl, &scl_state);
+		ndelay(i2c_sw_delay_ns);
 		if (gpio_get_value(pin_sda.pin))
 			*data |= mask;
-		gpio_set_pin_low(&pin_scl);
-		udelay(i2c_sw_delay);
+		gpio_set_pin_low(&pin_scl, &scl_state);
+		ndelay(i2c_sw_delay_ns);
 	}
 	return i2c_sw_ack();
 }
@@ -230,18 +284,27 @@ static unsigned char i2c_sw_read_byte(unsigned char *bdata)
 	return i2c_sw_read_cmd_data(NULL, 0, bdata, 1);
 }
 
-static unsigned char i2c_sw_write_cmd_data(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length)
+static unsigned char i2c_sw_write_message(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length)
 {
 	unsigned char status = 0;
-	i2c_sw_start_condition();
 	if (use_address)
 		status = i2c_sw_write_address(i2c_sw_address, 0);
 	if (cmd) {
 		while (!status && cmd_length--)
 			status |= i2c_sw_write_raw_byte(*cmd++);
 	}
-	while (!status && data_length--)
+	if (data) {
+		while (!status && data_length--)
 			status |= i2c_sw_write_raw_byte(*data++);
+	}
+	return status;
+}
+
+static unsigned char i2c_sw_write_cmd_data(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length)
+{
+	unsigned char status = 0;
+	i2c_sw_start_condition();
+	status = i2c_sw_write_message(cmd, cmd_length, data, data_length);
 	i2c_sw_stop_condition();
 	return status;
 }
@@ -255,3 +318,20 @@ static unsigned char i2c_sw_write_byte(unsigned char bdata)
 {
 	return i2c_sw_write_cmd_data(NULL, 0, &bdata, 1);
 }
+
+static unsigned char i2c_sw_write_cmd_data_batch(const struct protocol_xfer *xfers, unsigned short count)
+{
+	unsigned char status = 0;
+	unsigned short i;
+	if (!count)
+		return 0;
+	// A single transaction, the bus is only released after the last message.
+	i2c_sw_start_condition();
+	for (i = 0; !status && i < count; i++) {
+		if (i)
+			i2c_sw_restart_condition();
+		status = i2c_sw_write_message(xfers[i].cmd, xfers[i].cmd_length, xfers[i].data, xfers[i].data_length);
+	}
+	i2c_sw_stop_condition();
+	return status;
+}
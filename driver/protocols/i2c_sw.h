@@ -8,6 +8,15 @@
 #define I2C_DELAY_100KHz	5
 #define I2C_DELAY_20KHz	25
 
+struct i2c_sw_stats {
+	unsigned long acks;		// ACK phases clocked.
+	unsigned long fast_acks;	// ACK phases which skipped the clock stretch check.
+	unsigned long stretches;	// ACK phases in which the slave held SCL low.
+	unsigned long timeouts;		// Stretches which outlasted the timeout.
+	unsigned long nacks;
+};
+
 struct protocol_interface *init_sw_i2c(unsigned short address, unsigned char lsb_first, unsigned char clock_stretch_support, struct vfd_pin pin_scl, struct vfd_pin pin_sda, unsigned long i2c_delay, unsigned char(*test_connection)(const struct protocol_interface *protocol));
+void i2c_sw_get_stats(struct i2c_sw_stats *stats);
 
 #endif
@@ -12,6 +12,14 @@ enum protocol_types {
 	PROTOCOL_TYPE_SPI_4W,
 };
 
+// One command + data write, several of them can be submitted as a single bus transaction.
+struct protocol_xfer {
+	const unsigned char *cmd;
+	unsigned short cmd_length;
+	const unsigned char *data;
+	unsigned short data_length;
+};
+
 struct protocol_interface {
 	unsigned char (*read_cmd_data)(const unsigned char *cmd, unsigned short cmd_length, unsigned char *data, unsigned short data_length);
 	unsigned char (*read_data)(unsigned char *data, unsigned short length);
@@ -19,6 +27,7 @@ struct protocol_interface {
 	unsigned char (*write_cmd_data)(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length);
 	unsigned char (*write_data)(const unsigned char *data, unsigned short length);
 	unsigned char (*write_byte)(unsigned char bdata);
+	unsigned char (*write_cmd_data_batch)(const struct protocol_xfer *xfers, unsigned short count);
 	enum protocol_types protocol_type;
 };
 
@@ -0,0 +1,275 @@
+#include <linux/gpio.h>
+#include <linux/version.h>
+#include <linux/spi/spi.h>
+#include <linux/mutex.h>
+
+#include "spi_hw.h"
+
+#define pr_dbg2(args...) printk(KERN_DEBUG "OpenVFD: " args)
+#define LOW	0
+#define HIGH	1
+
+#define SPI_HW_MIN_BUFFER	64
+
+static unsigned char spi_hw_read_cmd_data(const unsigned char *cmd, unsigned short cmd_length, unsigned char *data, unsigned short data_length);
+static unsigned char spi_hw_read_data(unsigned char *data, unsigned short length);
+static unsigned char spi_hw_read_byte(unsigned char *bdata);
+static unsigned char spi_hw_write_cmd_data(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length);
+static unsigned char spi_hw_write_data(const unsigned char *data, unsigned short length);
+static unsigned char spi_hw_write_byte(unsigned char bdata);
+static unsigned char spi_hw_write_cmd_data_batch(const struct protocol_xfer *xfers, unsigned short count);
+
+static struct protocol_interface spi_hw_interface = {
+	.read_cmd_data = spi_hw_read_cmd_data,
+	.read_data = spi_hw_read_data,
+	.read_byte = spi_hw_read_byte,
+	.write_cmd_data = spi_hw_write_cmd_data,
+	.write_data = spi_hw_write_data,
+	.write_byte = spi_hw_write_byte,
+	.write_cmd_data_batch = spi_hw_write_cmd_data_batch,
+	.protocol_type = PROTOCOL_TYPE_SPI_3W
+};
+
+static struct spi_device *spi = NULL;		// Device in use by the protocol.
+static struct spi_device *spi_bound = NULL;	// Device bound through the device tree ("open,vfd-spi").
+static unsigned char spi_owned = 0;		// spi was created by init_hw_spi() and must be unregistered.
+static int pin_cs = -1;				// STB driven as a GPIO chip select, -1 for native CS.
+// Guards spi against the device going away, transfers fail with -ENODEV after that.
+static DEFINE_MUTEX(spi_mutex);
+/*
+ * Transfers are staged in a kmalloc()ed buffer, since the controllers hand us
+ * static arrays which live in module memory and are not safe for DMA. The
+ * buffer only grows, so after the first full frame there are no allocations.
+ */
+static unsigned char *xfer_buf = NULL;
+static unsigned int xfer_buf_size = 0;
+
+static unsigned char *spi_hw_reserve(unsigned int length)
+{
+	if (length > xfer_buf_size) {
+		unsigned int size = max_t(unsigned int, length, SPI_HW_MIN_BUFFER);
+		unsigned char *buf = kmalloc(size, GFP_KERNEL);
+		if (!buf)
+			return NULL;
+		kfree(xfer_buf);
+		xfer_buf = buf;
+		xfer_buf_size = size;
+	}
+	return xfer_buf;
+}
+
+static void spi_hw_release_device(void)
+{
+	if (spi && spi_owned)
+		spi_unregister_device(spi);
+	spi = NULL;
+	spi_owned = 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,15,0)
+static struct spi_device *spi_hw_new_device(unsigned char bus_num, unsigned int speed_hz)
+{
+	struct spi_device *spi_dev = NULL;
+	struct spi_master *master = spi_busnum_to_master(bus_num);
+	if (master) {
+		struct spi_board_info info = {
+			.modalias = "openvfd-bus",
+			.max_speed_hz = speed_hz,
+			.bus_num = bus_num,
+			.chip_select = 0,
+			.mode = SPI_MODE_3,
+		};
+		spi_dev = spi_new_device(master, &info);
+		put_device(&master->dev);
+	}
+	return spi_dev;
+}
+#endif
+
+struct protocol_interface *init_hw_spi(unsigned char _lsb_first, unsigned char _bus_num, struct vfd_pin stb, unsigned int _speed_hz)
+{
+	struct protocol_interface *spi_hw_ptr = NULL;
+	mutex_lock(&spi_mutex);
+	spi_hw_release_device();
+	if (spi_bound) {
+		spi = spi_bound;
+		pr_dbg2("Using SPI device %s bound through the device tree\n", dev_name(&spi->dev));
+	} else {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,15,0)
+		spi = spi_hw_new_device(_bus_num, _speed_hz);
+		spi_owned = spi != NULL;
+#endif
+	}
+	if (spi) {
+		pin_cs = stb.pin >= 0 ? stb.pin : -1;
+		spi->mode = SPI_MODE_3 | (_lsb_first ? SPI_LSB_FIRST : 0) | (pin_cs >= 0 ? SPI_NO_CS : 0);
+		spi->bits_per_word = 8;
+		if (_speed_hz)
+			spi->max_speed_hz = _speed_hz;
+		if (!spi_setup(spi) && spi_hw_reserve(SPI_HW_MIN_BUFFER)) {
+			if (pin_cs >= 0)
+				gpio_direction_output(pin_cs, HIGH);
+			spi_hw_ptr = &spi_hw_interface;
+			pr_dbg2("HW SPI interface intialized (SPI-%d, %u Hz, %s mode, %s chip select)\n", _bus_num, spi->max_speed_hz,
+				_lsb_first ? "LSB" : "MSB", pin_cs >= 0 ? "GPIO" : "native");
+		} else {
+			pr_dbg2("HW SPI interface failed to intialize. SPI-%d does not support the requested mode\n", _bus_num);
+			spi_hw_release_device();
+		}
+	} else {
+		pr_dbg2("HW SPI interface failed to intialize. Could not get SPI-%d device\n", _bus_num);
+	}
+	mutex_unlock(&spi_mutex);
+	return spi_hw_ptr;
+}
+
+static int spi_hw_transfer_locked(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *tx_data, unsigned char *rx_data, unsigned short data_length)
+{
+	int ret;
+	unsigned char *buf;
+	struct spi_transfer xfer = {
+		.len = cmd_length + data_length,
+	};
+	struct spi_message msg;
+
+	if (!spi)
+		return -ENODEV;
+	buf = spi_hw_reserve(cmd_length + data_length);
+	if (!buf)
+		return -ENOMEM;
+	if (!xfer.len)
+		return 0;
+	if (cmd)
+		memcpy(buf, cmd, cmd_length);
+	if (tx_data)
+		memcpy(buf + cmd_length, tx_data, data_length);
+	else
+		memset(buf + cmd_length, 0xFF, data_length);
+	xfer.tx_buf = buf;
+	if (rx_data)
+		xfer.rx_buf = buf;
+
+	spi_message_init(&msg);
+	spi_message_add_tail(&xfer, &msg);
+	if (pin_cs >= 0)
+		gpio_set_value(pin_cs, LOW);
+	ret = spi_sync(spi, &msg);
+	if (pin_cs >= 0)
+		gpio_set_value(pin_cs, HIGH);
+
+	if (ret)
+		dev_warn(&spi->dev, "spi transfer failed=%d", ret);
+	else if (rx_data)
+		memcpy(rx_data, buf + cmd_length, data_length);
+	return ret;
+}
+
+static int spi_hw_transfer(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *tx_data, unsigned char *rx_data, unsigned short data_length)
+{
+	int ret;
+	mutex_lock(&spi_mutex);
+	ret = spi_hw_transfer_locked(cmd, cmd_length, tx_data, rx_data, data_length);
+	mutex_unlock(&spi_mutex);
+	return ret;
+}
+
+static unsigned char spi_hw_read_cmd_data(const unsigned char *cmd, unsigned short cmd_length, unsigned char *data, unsigned short data_length)
+{
+	return spi_hw_transfer(cmd, cmd_length, NULL, data, data_length) ? 1 : 0;
+}
+
+static unsigned char spi_hw_read_data(unsigned char *data, unsigned short length)
+{
+	return spi_hw_read_cmd_data(NULL, 0, data, length);
+}
+
+static unsigned char spi_hw_read_byte(unsigned char *bdata)
+{
+	return spi_hw_read_cmd_data(NULL, 0, bdata, 1);
+}
+
+static unsigned char spi_hw_write_cmd_data(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length)
+{
+	return spi_hw_transfer(cmd, cmd_length, data, NULL, data_length) ? 1 : 0;
+}
+
+static unsigned char spi_hw_write_data(const unsigned char *data, unsigned short length)
+{
+	return spi_hw_write_cmd_data(NULL, 0, data, length);
+}
+
+static unsigned char spi_hw_write_byte(unsigned char bdata)
+{
+	return spi_hw_write_cmd_data(NULL, 0, &bdata, 1);
+}
+
+static unsigned char spi_hw_write_cmd_data_batch(const struct protocol_xfer *xfers, unsigned short count)
+{
+	unsigned char status = 0;
+	// Every transfer has to be framed by its own chip select cycle.
+	while (!status && count--) {
+		status = spi_hw_write_cmd_data(xfers->cmd, xfers->cmd_length, xfers->data, xfers->data_length);
+		xfers++;
+	}
+	return status;
+}
+
+static int openvfd_spi_probe(struct spi_device *spi_dev)
+{
+	spi_bound = spi_dev;
+	pr_dbg2("SPI device %s bound\n", dev_name(&spi_dev->dev));
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,18,0)
+static void openvfd_spi_remove(struct spi_device *spi_dev)
+#else
+static int openvfd_spi_remove(struct spi_device *spi_dev)
+#endif
+{
+	mutex_lock(&spi_mutex);
+	if (spi == spi_dev)
+		spi = NULL;
+	spi_bound = NULL;
+	mutex_unlock(&spi_mutex);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,18,0)
+	return 0;
+#endif
+}
+
+static const struct of_device_id openvfd_spi_dt_match[] = {
+	{.compatible = "open,vfd-spi",},
+	{},
+};
+
+static const struct spi_device_id openvfd_spi_id[] = {
+	{ "openvfd", 0 },
+	{ },
+};
+
+static struct spi_driver openvfd_spi_driver = {
+	.probe = openvfd_spi_probe,
+	.remove = openvfd_spi_remove,
+	.id_table = openvfd_spi_id,
+	.driver = {
+		   .name = "openvfd-spi",
+		   .owner = THIS_MODULE,
+		   .of_match_table = openvfd_spi_dt_match,
+		   },
+};
+
+int register_hw_spi_driver(void)
+{
+	return spi_register_driver(&openvfd_spi_driver);
+}
+
+void unregister_hw_spi_driver(void)
+{
+	mutex_lock(&spi_mutex);
+	spi_hw_release_device();
+	mutex_unlock(&spi_mutex);
+	spi_unregister_driver(&openvfd_spi_driver);
+	kfree(xfer_buf);
+	xfer_buf = NULL;
+	xfer_buf_size = 0;
+}
@@ -0,0 +1,12 @@
+#ifndef __SPI_HW_H__
+#define __SPI_HW_H__
+
+#include "protocol.h"
+
+#define SPI_HW_DEFAULT_SPEED_HZ	4000000
+
+struct protocol_interface *init_hw_spi(unsigned char _lsb_first, unsigned char _bus_num, struct vfd_pin stb, unsigned int _speed_hz);
+int register_hw_spi_driver(void);
+void unregister_hw_spi_driver(void);
+
+#endif
@@ -1,5 +1,10 @@
 #include <linux/gpio.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+#include <linux/gpio/consumer.h>
+#endif
 #include "spi_sw.h"
+#include "bus_timing.h"
 
 #define pr_dbg2(args...) printk(KERN_DEBUG "OpenVFD: " args)
 #define LOW	0
@@ -11,6 +16,7 @@ static unsigned char spi_sw_read_byte(unsigned char *bdata);
 static unsigned char spi_sw_write_cmd_data(const unsigned char *cmd, unsigned short cmd_length, const unsigned char *data, unsigned short data_length);
 static unsigned char spi_sw_write_data(const unsigned char *data, unsigned short length);
 static unsigned char spi_sw_write_byte(unsigned char bdata);
+static unsigned char spi_sw_write_cmd_data_batch(const struct protocol_xfer *xfers, unsigned short count);
 
 static struct protocol_interface spi_sw_interface = {
 	.read_cmd_data = spi_sw_read_cmd_data,
@@ -19,38 +25,98 @@ static struct protocol_interface spi_sw_interface = {
 	.write_cmd_data = spi_sw_write_cmd_data,
 	.write_data = spi_sw_write_data,
 	.write_byte = spi_sw_write_byte,
+	.write_cmd_data_batch = spi_sw_write_cmd_data_batch,
 	.protocol_type = PROTOCOL_TYPE_SPI_3W
 };
 
 static void spi_sw_stop_condition(void);
 
-static unsigned long spi_sw_delay = SPI_DELAY_100KHz;
+/*
+ * Last level driven on each bus pin, -1 while the pin is an input and -2
+ * when its state is unknown. Pins are only switched to output once, after that the
+ * cheaper gpio_set_value() is used, and writes of an unchanged level are
+ * skipped altogether.
+ */
+struct spi_sw_pin {
+	int pin;
+	signed char level;
+};
+
+static unsigned long spi_sw_delay_ns = SPI_DELAY_100KHz * 1000;
 static unsigned char lsb_first = 0;
-static int pin_clk = 0;
-static int pin_do  = 0;
-static int pin_stb = 0;
-static int pin_di  = 0;
+static struct spi_sw_pin pin_clk = { 0, -2 };
+static struct spi_sw_pin pin_do  = { 0, -2 };
+static struct spi_sw_pin pin_stb = { 0, -2 };
+static struct spi_sw_pin pin_din = { 0, -2 };
+static struct spi_sw_pin *pin_di = &pin_do;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+static struct gpio_desc *clk_do_desc[2] = { NULL, NULL };
+#endif
+
+static inline void spi_sw_set_pin(struct spi_sw_pin *pin, unsigned char level)
+{
+	if (pin->level == level)
+		return;
+	if (pin->level < 0)
+		gpio_direction_output(pin->pin, level);
+	else
+		gpio_set_value(pin->pin, level);
+	pin->level = level;
+}
+
+static inline void spi_sw_release_pin(struct spi_sw_pin *pin)
+{
+	gpio_direction_input(pin->pin);
+	pin->level = -1;
+}
+
+/*
+ * Falling clock edge and the next data bit. The slave samples on the rising
+ * edge, so both can be latched together when the pins are already outputs.
+ */
+static inline void spi_sw_clk_low_data(unsigned char level)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+	if (clk_do_desc[0] && clk_do_desc[1] && pin_clk.level == HIGH && pin_do.level >= 0 && pin_do.level != level) {
+		unsigned long values = level ? 0x02 : 0x00;
+		gpiod_set_array_value(2, clk_do_desc, NULL, &values);
+		pin_clk.level = LOW;
+		pin_do.level = level;
+		return;
+	}
+#endif
+	spi_sw_set_pin(&pin_clk, LOW);
+	spi_sw_set_pin(&pin_do, level);
+}
 
 static struct protocol_interface *init_sw_spi(unsigned char _lsb_first, struct vfd_pin clk, struct vfd_pin dout, struct vfd_pin stb, const struct vfd_pin *din, unsigned long _spi_sw_delay)
 {
 	struct protocol_interface *spi_sw_ptr = NULL;
 	if (clk.pin >= 0 && dout.pin >= 0 && stb.pin >= 0) {
-		pin_clk = clk.pin;
-		pin_do = dout.pin;
-		pin_stb = stb.pin;
+		pin_clk.pin = clk.pin;
+		pin_do.pin = dout.pin;
+		pin_stb.pin = stb.pin;
+		pin_clk.level = pin_do.level = pin_stb.level = pin_din.level = -2;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+		clk_do_desc[0] = gpio_to_desc(clk.pin);
+		clk_do_desc[1] = gpio_to_desc(dout.pin);
+#endif
 		lsb_first = _lsb_first;
-		spi_sw_delay = _spi_sw_delay;
 		if (!din) {
-			pin_di = pin_do;
+			pin_di = &pin_do;
 			spi_sw_interface.protocol_type = PROTOCOL_TYPE_SPI_3W;
 			spi_sw_ptr = &spi_sw_interface;
 		} else if (din->pin >= 0) {
-			pin_di = din->pin;
+			pin_din.pin = din->pin;
+			pin_di = &pin_din;
 			spi_sw_interface.protocol_type = PROTOCOL_TYPE_SPI_4W;
 			spi_sw_ptr = &spi_sw_interface;
 		}
-		if (spi_sw_ptr)
+		if (spi_sw_ptr) {
 			spi_sw_stop_condition();
+			// CLK idles high after the stop condition, rewriting it does not clock the slave.
+			spi_sw_delay_ns = bus_timing_delay_ns(_spi_sw_delay, bus_timing_gpio_cost(pin_clk.pin, HIGH));
+		}
 	}
 	return spi_sw_ptr;
 }
@@ -59,7 +125,7 @@ struct protocol_interface *init_sw_spi_3w(unsigned char _lsb_first, struct vfd_p
 {
 	struct protocol_interface *spi_sw_3w_ptr = init_sw_spi(_lsb_first, clk, dat, stb, NULL, _spi_sw_delay);
 	if (spi_sw_3w_ptr)
-		pr_dbg2("SW SPI 3-wire interface intialized (%s mode)\n", lsb_first ? "LSB" : "MSB");
+		pr_dbg2("SW SPI 3-wire interface intialized (%s mode, %lu ns delay)\n", lsb_first ? "LSB" : "MSB", spi_sw_delay_ns);
 	else
 		pr_dbg2("SW SPI 3-wire interface failed to intialize. Invalid CLK (%d), DAT (%d) or STB (%d) pins\n", clk.pin, dat.pin, stb.pin);
 	return spi_sw_3w_ptr;
@@ -69,7 +135,7 @@ struct protocol_interface *init_sw_spi_4w(unsigned char _lsb_first, struct vfd_p
 {
 	struct protocol_interface *spi_sw_4w_ptr = init_sw_spi(_lsb_first, clk, dout, stb, &din, _spi_sw_delay);
 	if (spi_sw_4w_ptr)
-		pr_dbg2("SW SPI 4-wire interface intialized (%s mode)\n", lsb_first ? "LSB" : "MSB");
+		pr_dbg2("SW SPI 4-wire interface intialized (%s mode, %lu ns delay)\n", lsb_first ? "LSB" : "MSB", spi_sw_delay_ns);
 	else
 		pr_dbg2("SW SPI 4-wire interface failed to intialize. Invalid CLK (%d), DOUT (%d), DIN (%d) or STB (%d) pins\n", clk.pin, dout.pin, din.pin, stb.pin);
 	return spi_sw_4w_ptr;
@@ -77,33 +143,34 @@ struct protocol_interface *init_sw_spi_4w(unsigned char _lsb_first, struct vfd_p
 
 static void spi_sw_start_condition(void)
 {
-	gpio_direction_output(pin_stb, LOW);
-	udelay(spi_sw_delay);
+	spi_sw_set_pin(&pin_stb, LOW);
+	ndelay(spi_sw_delay_ns);
 }
 
 static void spi_sw_stop_condition(void)
 {
-	gpio_direction_output(pin_clk, HIGH);
-	udelay(spi_sw_delay);
-	gpio_direction_output(pin_stb, HIGH);
-	gpio_direction_output(pin_do, HIGH);
-	gpio_direction_input(pin_do);
-	udelay(spi_sw_delay);
+	spi_sw_set_pin(&pin_clk, HIGH);
+	ndelay(spi_sw_delay_ns);
+	spi_sw_set_pin(&pin_stb, HIGH);
+	spi_sw_set_pin(&pin_do, HIGH);
+	spi_sw_release_pin(&pin_do);
+	ndelay(spi_sw_delay_ns);
 }
 
+/*
+ * Two GPIO writes per bit is the floor: the falling edge carries the next data
+ * bit, but the rising edge has to be a write of its own. The slave samples on
+ * it, so changing the data together with it would leave no setup time.
+ */
 static unsigned char spi_sw_write_raw_byte(unsigned char data)
 {
 	unsigned char i = 8;
 	unsigned char mask = lsb_first ? 0x01 : 0x80;
 	while (i--) {
-		gpio_direction_output(pin_clk, LOW);
-		udelay(spi_sw_delay);
-		if (data & mask)
-			gpio_direction_output(pin_do, HIGH);
-		else
-			gpio_direction_output(pin_do, LOW);
-		gpio_direction_output(pin_clk, HIGH);
-		udelay(spi_sw_delay);
+		spi_sw_clk_low_data(data & mask ? HIGH : LOW);
+		ndelay(spi_sw_delay_ns);
+		spi_sw_set_pin(&pin_clk, HIGH);
+		ndelay(spi_sw_delay_ns);
 		if (lsb_first)
 			data >>= 1;
 		else
@@ -117,17 +184,18 @@ static unsigned char spi_sw_read_raw_byte(unsigned char *data)
 	unsigned char i = 8;
 	unsigned char mask = lsb_first ? 0x80 : 0x01;
 	*data = 0;
-	gpio_direction_input(pin_di);
+	if (pin_di->level != -1)
+		spi_sw_release_pin(pin_di);
 	while (i--) {
 		if (lsb_first)
 			*data >>= 1;
 		else
 			*data <<= 1;
-		gpio_direction_output(pin_clk, LOW);
-		udelay(spi_sw_delay);
-		gpio_direction_output(pin_clk, HIGH);
-		udelay(spi_sw_delay);
-		if (gpio_get_value(pin_di))
+		spi_sw_set_pin(&pin_clk, LOW);
+		ndelay(spi_sw_delay_ns);
+		spi_sw_set_pin(&pin_clk, HIGH);
+		ndelay(spi_sw_delay_ns);
+		if (gpio_get_value(pin_di->pin))
 			*data |= mask;
 	}
 	return 0;
@@ -192,3 +260,14 @@ static unsigned char spi_sw_write_byte(unsigned char bdata)
 {
 	return spi_sw_write_cmd_data(NULL, 0, &bdata, 1);
 }
+
+static unsigned char spi_sw_write_cmd_data_batch(const struct protocol_xfer *xfers, unsigned short count)
+{
+	unsigned char status = 0;
+	// Every transfer has to be framed by its own chip select cycle.
+	while (!status && count--) {
+		status = spi_sw_write_cmd_data(xfers->cmd, xfers->cmd_length, xfers->data, xfers->data_length);
+		xfers++;
+	}
+	return status;
+}
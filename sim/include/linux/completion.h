@@ -0,0 +1,27 @@
+#ifndef __SIM_LINUX_COMPLETION_H__
+#define __SIM_LINUX_COMPLETION_H__
+
+#include <linux/delay.h>
+#include <linux/jiffies.h>
+
+/* Nothing runs concurrently in the harness, a wait that is not done yet times out. */
+struct completion {
+	unsigned int done;
+};
+
+#define DECLARE_COMPLETION(name)	struct completion name = { 0 }
+
+static inline void reinit_completion(struct completion *x) { x->done = 0; }
+static inline void complete(struct completion *x) { x->done++; }
+
+static inline unsigned long wait_for_completion_timeout(struct completion *x, unsigned long timeout)
+{
+	if (x->done) {
+		x->done--;
+		return timeout ? timeout : 1;
+	}
+	msleep(jiffies_to_msecs(timeout));
+	return 0;
+}
+
+#endif
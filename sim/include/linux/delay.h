@@ -0,0 +1,10 @@
+#ifndef __SIM_LINUX_DELAY_H__
+#define __SIM_LINUX_DELAY_H__
+
+void udelay(unsigned long usecs);
+void ndelay(unsigned long nsecs);
+void mdelay(unsigned long msecs);
+void msleep(unsigned int msecs);
+void usleep_range(unsigned long min, unsigned long max);
+
+#endif
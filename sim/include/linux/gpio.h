@@ -0,0 +1,10 @@
+#ifndef __SIM_LINUX_GPIO_H__
+#define __SIM_LINUX_GPIO_H__
+
+int gpio_direction_output(unsigned gpio, int value);
+int gpio_direction_input(unsigned gpio);
+int gpio_get_value(unsigned gpio);
+void gpio_set_value(unsigned gpio, int value);
+int gpio_to_irq(unsigned gpio);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __SIM_LINUX_GPIO_CONSUMER_H__
+#define __SIM_LINUX_GPIO_CONSUMER_H__
+
+struct gpio_desc;
+struct gpio_array;
+
+struct gpio_desc *gpio_to_desc(unsigned gpio);
+int desc_to_gpio(const struct gpio_desc *desc);
+int gpiod_set_array_value(unsigned int array_size, struct gpio_desc **desc_array,
+			  struct gpio_array *array_info, unsigned long *value_bitmap);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __SIM_LINUX_I2C_H__
+#define __SIM_LINUX_I2C_H__
+
+#include <linux/kernel.h>
+
+#define I2C_M_RD		0x0001
+#define I2C_M_TEN		0x0010
+#define I2C_M_NOSTART		0x4000
+
+#define I2C_FUNC_I2C		0x00000001
+#define I2C_FUNC_NOSTART	0x00000010
+
+struct i2c_adapter {
+	char name[48];
+	struct device dev;
+};
+
+struct i2c_msg {
+	unsigned short addr;
+	unsigned short flags;
+	unsigned short len;
+	unsigned char *buf;
+};
+
+struct i2c_adapter *i2c_get_adapter(int nr);
+void i2c_put_adapter(struct i2c_adapter *adap);
+int i2c_check_functionality(struct i2c_adapter *adap, unsigned int func);
+int i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num);
+
+#define dev_warn(dev, fmt, ...)	printk(KERN_WARNING fmt, ##__VA_ARGS__)
+
+#endif
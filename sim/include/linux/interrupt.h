@@ -0,0 +1,17 @@
+#ifndef __SIM_LINUX_INTERRUPT_H__
+#define __SIM_LINUX_INTERRUPT_H__
+
+typedef enum {
+	IRQ_NONE,
+	IRQ_HANDLED,
+} irqreturn_t;
+
+typedef irqreturn_t (*irq_handler_t)(int irq, void *data);
+
+#define IRQF_TRIGGER_RISING	0x00000001
+#define IRQF_TRIGGER_FALLING	0x00000002
+
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags, const char *name, void *data);
+const void *free_irq(unsigned int irq, void *data);
+
+#endif
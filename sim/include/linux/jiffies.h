@@ -0,0 +1,15 @@
+#ifndef __SIM_LINUX_JIFFIES_H__
+#define __SIM_LINUX_JIFFIES_H__
+
+#define HZ	1000
+
+unsigned long sim_jiffies(void);
+#define jiffies			sim_jiffies()
+
+static inline unsigned int jiffies_to_msecs(unsigned long j) { return (unsigned int)j; }
+static inline unsigned long msecs_to_jiffies(unsigned int m) { return m; }
+
+#define time_after(a, b)	((long)((b) - (a)) < 0)
+#define time_before(a, b)	time_after(b, a)
+
+#endif
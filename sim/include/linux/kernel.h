@@ -0,0 +1,63 @@
+#ifndef __SIM_LINUX_KERNEL_H__
+#define __SIM_LINUX_KERNEL_H__
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+
+#define KERN_ALERT	""
+#define KERN_ERR	""
+#define KERN_WARNING	""
+#define KERN_INFO	""
+#define KERN_DEBUG	""
+
+#define __user
+#define __iomem
+#define __aligned(x)	__attribute__((aligned(x)))
+
+#ifndef EREMOTEIO
+#define EREMOTEIO	121
+#endif
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int scnprintf(char *buf, size_t size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#define pr_info(fmt, ...)	printk(KERN_INFO fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)	printk(KERN_WARNING fmt, ##__VA_ARGS__)
+
+#define min(x, y) ({			\
+	typeof(x) _min1 = (x);		\
+	typeof(y) _min2 = (y);		\
+	_min1 < _min2 ? _min1 : _min2; })
+
+#define max(x, y) ({			\
+	typeof(x) _max1 = (x);		\
+	typeof(y) _max2 = (y);		\
+	_max1 > _max2 ? _max1 : _max2; })
+
+#define min_t(type, x, y)	min((type)(x), (type)(y))
+#define max_t(type, x, y)	max((type)(x), (type)(y))
+
+#define swap(a, b) \
+	do { typeof(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define ARRAY_SIZE(arr)		(sizeof(arr) / sizeof((arr)[0]))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+typedef struct {
+	int dummy;
+} wait_queue_head_t;
+
+struct timer_list {
+	int dummy;
+};
+
+struct device {
+	const char *init_name;
+};
+
+#endif
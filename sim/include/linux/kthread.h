@@ -0,0 +1,16 @@
+#ifndef __SIM_LINUX_KTHREAD_H__
+#define __SIM_LINUX_KTHREAD_H__
+
+struct task_struct {
+	int (*threadfn)(void *data);
+	void *data;
+};
+
+struct task_struct *sim_kthread_create(int (*threadfn)(void *data), void *data);
+#define kthread_create(threadfn, data, namefmt, ...)	sim_kthread_create(threadfn, data)
+
+int wake_up_process(struct task_struct *task);
+int kthread_stop(struct task_struct *task);
+int kthread_should_stop(void);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __SIM_LINUX_KTIME_H__
+#define __SIM_LINUX_KTIME_H__
+
+#define NSEC_PER_USEC	1000UL
+#define NSEC_PER_SEC	1000000000UL
+
+typedef unsigned long long u64;
+
+/* Monotonic time of the recording model, advanced by GPIO calls and delays. */
+u64 ktime_get_ns(void);
+
+#endif
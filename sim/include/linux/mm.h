@@ -0,0 +1,9 @@
+#ifndef __SIM_LINUX_MM_H__
+#define __SIM_LINUX_MM_H__
+
+#define PAGE_SHIFT		12
+#define PAGE_SIZE		(1UL << PAGE_SHIFT)
+#define PAGE_MASK		(~(PAGE_SIZE - 1))
+#define PAGE_ALIGN(addr)	(((addr) + PAGE_SIZE - 1) & PAGE_MASK)
+
+#endif
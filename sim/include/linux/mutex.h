@@ -0,0 +1,23 @@
+#ifndef __SIM_LINUX_MUTEX_H__
+#define __SIM_LINUX_MUTEX_H__
+
+/* The harness is single threaded, locks only track their state. */
+struct mutex {
+	int locked;
+};
+
+#define DEFINE_MUTEX(name)	struct mutex name = { 0 }
+
+static inline void mutex_init(struct mutex *lock) { lock->locked = 0; }
+static inline void mutex_destroy(struct mutex *lock) { }
+static inline void mutex_lock(struct mutex *lock) { lock->locked = 1; }
+static inline void mutex_unlock(struct mutex *lock) { lock->locked = 0; }
+static inline int mutex_trylock(struct mutex *lock)
+{
+	if (lock->locked)
+		return 0;
+	lock->locked = 1;
+	return 1;
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __SIM_LINUX_SCHED_H__
+#define __SIM_LINUX_SCHED_H__
+
+#define TASK_RUNNING		0
+#define TASK_INTERRUPTIBLE	1
+
+#define set_current_state(state)	do { } while (0)
+#define __set_current_state(state)	do { } while (0)
+
+long schedule_timeout(long timeout);
+
+#endif
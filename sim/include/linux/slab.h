@@ -0,0 +1,16 @@
+#ifndef __SIM_LINUX_SLAB_H__
+#define __SIM_LINUX_SLAB_H__
+
+#include <stddef.h>
+
+typedef unsigned int gfp_t;
+
+#define GFP_KERNEL	0x01u
+#define GFP_ATOMIC	0x02u
+#define GFP_DMA		0x04u
+
+void *kmalloc(size_t size, gfp_t flags);
+void *kzalloc(size_t size, gfp_t flags);
+void kfree(const void *ptr);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef __SIM_LINUX_SPI_H__
+#define __SIM_LINUX_SPI_H__
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+
+#define SPI_CPHA		0x01
+#define SPI_CPOL		0x02
+#define SPI_MODE_3		(SPI_CPOL | SPI_CPHA)
+#define SPI_LSB_FIRST		0x08
+#define SPI_NO_CS		0x40
+
+#define THIS_MODULE		NULL
+
+struct spi_controller {
+	int bus_num;
+	struct device dev;
+};
+#define spi_master		spi_controller
+
+struct spi_device {
+	struct device dev;
+	struct spi_controller *controller;
+	unsigned int max_speed_hz;
+	unsigned char chip_select;
+	unsigned char bits_per_word;
+	unsigned int mode;
+};
+
+struct spi_board_info {
+	char modalias[32];
+	unsigned int max_speed_hz;
+	unsigned short bus_num;
+	unsigned short chip_select;
+	unsigned int mode;
+};
+
+struct spi_transfer {
+	const void *tx_buf;
+	void *rx_buf;
+	unsigned int len;
+	struct list_head transfer_list;
+};
+
+struct spi_message {
+	struct list_head transfers;
+};
+
+struct of_device_id {
+	char compatible[128];
+};
+
+struct spi_device_id {
+	char name[32];
+	unsigned long driver_data;
+};
+
+struct device_driver {
+	const char *name;
+	void *owner;
+	const struct of_device_id *of_match_table;
+};
+
+struct spi_driver {
+	const struct spi_device_id *id_table;
+	int (*probe)(struct spi_device *spi);
+	int (*remove)(struct spi_device *spi);
+	struct device_driver driver;
+};
+
+static inline void spi_message_init(struct spi_message *m)
+{
+	INIT_LIST_HEAD(&m->transfers);
+}
+
+static inline void spi_message_add_tail(struct spi_transfer *t, struct spi_message *m)
+{
+	list_add_tail(&t->transfer_list, &m->transfers);
+}
+
+struct spi_controller *spi_busnum_to_master(unsigned short bus_num);
+struct spi_device *spi_new_device(struct spi_controller *ctlr, struct spi_board_info *chip);
+void spi_unregister_device(struct spi_device *spi);
+int spi_setup(struct spi_device *spi);
+int spi_sync(struct spi_device *spi, struct spi_message *message);
+int spi_register_driver(struct spi_driver *sdrv);
+void spi_unregister_driver(struct spi_driver *sdrv);
+
+#define put_device(dev)		do { } while (0)
+#define dev_name(dev)		((dev)->init_name)
+#ifndef dev_warn
+#define dev_warn(dev, fmt, ...)	printk(KERN_WARNING fmt, ##__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __SIM_LINUX_SPINLOCK_H__
+#define __SIM_LINUX_SPINLOCK_H__
+
+/* The harness is single threaded, locks only track their state. */
+typedef struct {
+	int locked;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(name)	spinlock_t name = { 0 }
+
+static inline void spin_lock_init(spinlock_t *lock) { lock->locked = 0; }
+#define spin_lock_irqsave(lock, flags)		do { (flags) = 0; (lock)->locked = 1; } while (0)
+#define spin_unlock_irqrestore(lock, flags)	do { (void)(flags); (lock)->locked = 0; } while (0)
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef __SIM_LINUX_VERSION_H__
+#define __SIM_LINUX_VERSION_H__
+
+#define KERNEL_VERSION(a, b, c)	(((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE	KERNEL_VERSION(5, 10, 0)
+
+#endif
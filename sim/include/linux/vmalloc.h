@@ -0,0 +1,9 @@
+#ifndef __SIM_LINUX_VMALLOC_H__
+#define __SIM_LINUX_VMALLOC_H__
+
+#include <stddef.h>
+
+void *vmalloc_user(unsigned long size);
+void vfree(const void *addr);
+
+#endif
@@ -0,0 +1,506 @@
+/*
+ * Per-frame bus cost of every controller for a set of scripted display
+ * sequences, measured against the recording kernel model in sim_kernel.c.
+ *
+ * The soft protocols are driven at the delay the controller selects (or at
+ * the -f bus frequency). The estimates at the other bus rates replace the
+ * recorded ndelay() bit timing by the delay bus_timing computes for the rate,
+ * GPIO call, udelay() and sleep costs are taken as is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../driver/controllers/controller_list.h"
+#include "../driver/protocols/i2c_sw.h"
+#include "../driver/protocols/spi_sw.h"
+#include "../driver/protocols/spi_hw.h"
+#include "../driver/protocols/bus_timing.h"
+#include "sim.h"
+
+#define PIN_CLK		1
+#define PIN_DAT		2
+#define PIN_STB		3
+#define PIN_RST		4
+#define PIN_DC		5
+#define PIN_BUSY	6
+
+#define MAX_FRAMES	240
+
+struct bench_panel {
+	const char *name;
+	struct vfd_display display;
+	unsigned char hw_protocol;	/* PROTOCOL_* passed through vfd_gpio_protocol. */
+	enum sim_bus_type bus;
+	unsigned char lsb_first;
+	unsigned long native_delay;	/* Protocol delay selected by the controller (us). */
+	enum sim_panel_type model;
+};
+
+struct bench_scenario {
+	const char *name;
+	unsigned short frames;
+	void (*frame)(struct vfd_display_data *data, unsigned short i);
+	void (*draw)(struct controller_interface *controller, unsigned short i);	/* Draws through the mmap() frame buffer instead. */
+};
+
+struct bench_result {
+	unsigned short frames;
+	unsigned long long ram_hash;
+	unsigned long long bus_hash;
+	struct sim_stats total;
+	struct sim_stats peak;
+};
+
+static const struct bench_panel panels[] = {
+	{ "fd628",		{ 0x00, 0x00, 0x00, CONTROLLER_FD628 },		PROTOCOL_NONE, SIM_BUS_SPI, 1, SPI_DELAY_100KHz, SIM_PANEL_NONE },
+	{ "fd650",		{ 0x00, 0x00, 0x00, CONTROLLER_FD650 },		PROTOCOL_NONE, SIM_BUS_I2C, 0, I2C_DELAY_100KHz, SIM_PANEL_NONE },
+	{ "hd44780-16x2",	{ 0x28, 0x27, 0x00, CONTROLLER_HD44780 },	PROTOCOL_NONE, SIM_BUS_I2C, 0, I2C_DELAY_500KHz, SIM_PANEL_NONE },
+	{ "ssd1306-128x64",	{ 0x3F, 0x3C, 0x00, CONTROLLER_SSD1306 },	PROTOCOL_NONE, SIM_BUS_I2C, 0, I2C_DELAY_500KHz, SIM_PANEL_SSD1306 },
+	{ "ssd1306-128x64-hw",	{ 0x3F, 0x3C, 0x00, CONTROLLER_SSD1306 },	PROTOCOL_I2C, SIM_BUS_NONE, 0, 0, SIM_PANEL_SSD1306 },
+	{ "ssd1306-128x64-spi",	{ 0x3F, 0x81, 0x00, CONTROLLER_SSD1306 },	PROTOCOL_NONE, SIM_BUS_SPI, 0, SPI_DELAY_500KHz, SIM_PANEL_SSD1306 },
+	{ "ssd1306-128x64-hwspi",	{ 0x3F, 0x81, 0x00, CONTROLLER_SSD1306 },	PROTOCOL_SPI, SIM_BUS_NONE, 0, 0, SIM_PANEL_SSD1306 },
+	{ "sh1106-128x64",	{ 0x3F, 0x3C, 0x00, CONTROLLER_SH1106 },	PROTOCOL_NONE, SIM_BUS_I2C, 0, I2C_DELAY_500KHz, SIM_PANEL_SH1106 },
+	{ "pcd8544-84x48",	{ 0x6C, 0x80, 0x00, CONTROLLER_PCD8544 },	PROTOCOL_NONE, SIM_BUS_SPI, 0, SPI_DELAY_500KHz, SIM_PANEL_PCD8544 },
+	{ "pcd8544-84x48-hwspi",	{ 0x6C, 0x80, 0x00, CONTROLLER_PCD8544 },	PROTOCOL_SPI, SIM_BUS_NONE, 0, 0, SIM_PANEL_PCD8544 },
+	{ "il3829-200x200",	{ 0x00, 0x80, 0x00, CONTROLLER_IL3829 },	PROTOCOL_NONE, SIM_BUS_SPI, 0, SPI_DELAY_500KHz, SIM_PANEL_IL3829 },
+	{ "il3829-200x200-hwspi",	{ 0x00, 0x80, 0x00, CONTROLLER_IL3829 },	PROTOCOL_SPI, SIM_BUS_NONE, 0, 0, SIM_PANEL_IL3829 },
+};
+
+static const unsigned long bus_rates[] = { 500000, 250000, 100000, 20000 };
+static const char *bus_rate_names[] = { "500k", "250k", "100k", "20k" };
+
+static const char long_title[] = "The Saga of the Viking Women and their Voyage to the Waters of the Great Sea Serpent";
+
+static void frame_clock(struct vfd_display_data *data, unsigned short i)
+{
+	unsigned int secs = 23 * 3600 + 58 * 60 + 30 + i / 2;
+	data->mode = DISPLAY_MODE_CLOCK;
+	data->colon_on = i & 1 ? 0 : 1;
+	data->time_date.hours = (secs / 3600) % 24;
+	data->time_date.minutes = (secs / 60) % 60;
+	data->time_date.seconds = secs % 60;
+	data->time_date.day_of_week = 3;
+	data->time_date.day = 17;
+	data->time_date.month = 9;
+	data->time_date.year = 2026;
+}
+
+static void frame_channel(struct vfd_display_data *data, unsigned short i)
+{
+	data->mode = DISPLAY_MODE_CHANNEL;
+	data->channel_data.channel = 101 + (i / 3) * 7;
+	data->channel_data.channel_count = 999;
+}
+
+static void frame_title(struct vfd_display_data *data, unsigned short i)
+{
+	size_t len = sizeof(long_title) - 1;
+	size_t start = i % len;
+	data->mode = DISPLAY_MODE_TITLE;
+	snprintf(data->string_main, sizeof(data->string_main), "%.20s", long_title + start);
+}
+
+static void frame_playback(struct vfd_display_data *data, unsigned short i)
+{
+	unsigned int secs = 5 * 60 + 50 + i / 2;
+	data->mode = DISPLAY_MODE_PLAYBACK_TIME;
+	data->colon_on = i & 1 ? 0 : 1;
+	data->time_date.hours = secs / 3600;
+	data->time_date.minutes = (secs / 60) % 60;
+	data->time_date.seconds = secs % 60;
+	snprintf(data->string_main, sizeof(data->string_main), "%s", "Night Drive");
+}
+
+/* Switches between the modes above every few frames, each switch redraws the whole panel. */
+static void frame_modes(struct vfd_display_data *data, unsigned short i)
+{
+	static void (*const modes[])(struct vfd_display_data *data, unsigned short i) = { frame_clock, frame_channel, frame_title, frame_playback };
+	modes[(i / 4) % 4](data, i);
+}
+
+static void fb_fill(unsigned char *fb, const struct vfd_fb_info *info, const struct vfd_fb_rect *r, unsigned char on)
+{
+	unsigned short x, y;
+	for (y = r->y; y < r->y + r->height && y < info->height; y++) {
+		for (x = r->x; x < r->x + r->width && x < info->width; x++) {
+			unsigned char *p, bit;
+			if (info->format == VFD_FB_FORMAT_HMSB) {
+				p = &fb[y * info->line_length + x / 8];
+				bit = 0x80 >> (x % 8);
+			} else {
+				p = &fb[(y / 8) * info->line_length + x];
+				bit = 1 << (y % 8);
+			}
+			*p = on ? (*p | bit) : (*p & ~bit);
+		}
+	}
+}
+
+#define FB_BOX	12
+
+/* A box bouncing around the panel, each frame erases the old one and flushes both. */
+static void draw_fb_box(struct controller_interface *controller, unsigned short i)
+{
+	static struct vfd_fb_rect box;
+	struct vfd_fb_info info;
+	struct vfd_fb_rect r;
+	unsigned char *fb = controller->get_framebuffer(&info);
+	unsigned short w = info.width - FB_BOX, h = info.height - FB_BOX;
+	unsigned short x = (i * 5) % (2 * w), y = (i * 3) % (2 * h);
+
+	if (!i)
+		memset(&box, 0, sizeof(box));
+	r = box;
+	fb_fill(fb, &info, &box, 0);
+	box.x = x < w ? x : 2 * w - x;
+	box.y = y < h ? y : 2 * h - y;
+	box.width = box.height = FB_BOX;
+	fb_fill(fb, &info, &box, 1);
+	if (r.width) {
+		r.width = max(r.x + r.width, box.x + box.width) - min(r.x, box.x);
+		r.height = max(r.y + r.height, box.y + box.height) - min(r.y, box.y);
+		r.x = min(r.x, box.x);
+		r.y = min(r.y, box.y);
+	} else {
+		r = box;
+	}
+	controller->flush_framebuffer(&r);
+}
+
+static const struct bench_scenario scenarios[] = {
+	{ "clock",	120,	frame_clock,	NULL },
+	{ "channel",	60,	frame_channel,	NULL },
+	{ "title",	60,	frame_title,	NULL },
+	{ "playback",	120,	frame_playback,	NULL },
+	{ "modes",	120,	frame_modes,	NULL },
+	{ "fb",		120,	NULL,		draw_fb_box },
+};
+
+static struct mutex mutex;
+static struct vfd_dev vfd_dev;
+
+static struct controller_interface *select_controller(struct vfd_dev *dev)
+{
+	switch (dev->dtb_active.display.controller) {
+	case CONTROLLER_FD628:
+	case CONTROLLER_FD620:
+	case CONTROLLER_TM1618:
+	case CONTROLLER_HBS658:
+		return init_fd628(dev);
+	case CONTROLLER_FD650:
+	case CONTROLLER_FD655:
+	case CONTROLLER_FD6551:
+		return init_fd650(dev);
+	case CONTROLLER_IL3829:
+		return init_il3829(dev);
+	case CONTROLLER_PCD8544:
+		return init_pcd8544(dev);
+	case CONTROLLER_SH1106:
+	case CONTROLLER_SSD1306:
+		return init_ssd1306(dev);
+	case CONTROLLER_HD44780:
+		return init_hd47780(dev);
+	default:
+		return init_dummy(dev);
+	}
+}
+
+static void init_pin(struct vfd_pin *pin, int gpio)
+{
+	memset(pin, 0, sizeof(*pin));
+	pin->pin = gpio;
+}
+
+static struct controller_interface *setup_panel(const struct bench_panel *panel)
+{
+	struct controller_interface *controller;
+	unsigned char i;
+
+	sim_reset();
+	memset(&vfd_dev, 0, sizeof(vfd_dev));
+	mutex_init(&mutex);
+	vfd_dev.mutex = &mutex;
+	spin_lock_init(&vfd_dev.state_lock);
+	init_pin(&vfd_dev.clk_pin, PIN_CLK);
+	init_pin(&vfd_dev.dat_pin, PIN_DAT);
+	init_pin(&vfd_dev.stb_pin, PIN_STB);
+	init_pin(&vfd_dev.gpio0_pin, PIN_RST);
+	init_pin(&vfd_dev.gpio1_pin, PIN_DC);
+	init_pin(&vfd_dev.gpio2_pin, PIN_BUSY);
+	init_pin(&vfd_dev.gpio3_pin, -1);
+	vfd_dev.hw_protocol.protocol = panel->hw_protocol;
+	vfd_dev.hw_protocol.speed_hz = SPI_HW_DEFAULT_SPEED_HZ;
+	for (i = 0; i < sizeof(vfd_dev.dtb_active.dat_index); i++)
+		vfd_dev.dtb_active.dat_index[i] = i;
+	for (i = 0; i < sizeof(vfd_dev.dtb_active.led_dots); i++)
+		vfd_dev.dtb_active.led_dots[i] = ledDots[i % LED_DOT_MAX];
+	vfd_dev.dtb_active.display = panel->display;
+	vfd_dev.brightness = 7;
+	vfd_dev.power = 1;
+
+	sim_gpio_set_input(PIN_BUSY, 0);
+	sim_bus_attach(panel->bus, PIN_CLK, PIN_DAT, PIN_STB, panel->lsb_first);
+	sim_panel_attach(panel->model, panel->bus == SIM_BUS_I2C || panel->hw_protocol == PROTOCOL_I2C, PIN_DC);
+
+	controller = select_controller(&vfd_dev);
+	if (!controller->init())
+		return NULL;
+	controller->set_power(1);
+	controller->set_brightness_level(vfd_dev.brightness);
+	sim_kthread_run();
+	return controller;
+}
+
+static void stats_add(struct sim_stats *total, struct sim_stats *peak, const struct sim_stats *s)
+{
+	const unsigned long long *src = (const unsigned long long *)s;
+	unsigned long long *dst = (unsigned long long *)total;
+	unsigned long long *max = (unsigned long long *)peak;
+	size_t i;
+	for (i = 0; i < sizeof(*s) / sizeof(*src); i++) {
+		dst[i] += src[i];
+		if (src[i] > max[i])
+			max[i] = src[i];
+	}
+}
+
+static void run_scenario(struct controller_interface *controller, const struct bench_scenario *scenario, struct bench_result *result)
+{
+	struct vfd_display_data data;
+	struct sim_stats stats;
+	unsigned short i;
+
+	memset(result, 0, sizeof(*result));
+	result->ram_hash = 0xCBF29CE484222325ULL;
+	for (i = 0; i < scenario->frames && i < MAX_FRAMES; i++) {
+		sim_stats_reset();
+		if (scenario->draw) {
+			scenario->draw(controller, i);
+		} else {
+			memset(&data, 0, sizeof(data));
+			scenario->frame(&data, i);
+			controller->write_display_data(&data);
+		}
+		sim_kthread_run();
+		sim_stats_get(&stats);
+		stats_add(&result->total, &result->peak, &stats);
+		result->ram_hash = sim_panel_hash(result->ram_hash);
+		result->frames++;
+	}
+	result->bus_hash = sim_bus_hash();
+}
+
+static double estimate_ns(const struct bench_panel *panel, const struct sim_stats *s, unsigned long rate_hz)
+{
+	const struct sim_cost *cost = sim_get_cost();
+	unsigned long speed_hz = bus_timing_get_speed();
+	double ns = (double)s->gpio_dir_calls * cost->gpio_dir_ns +
+		(double)(s->gpio_set_calls + s->gpio_get_calls) * cost->gpio_value_ns +
+		(double)s->sleep_ns + (double)s->bus_ns + (double)(s->delay_ns - s->ndelay_ns);
+	if (panel->native_delay) {
+		/* Soft I2C measures the release of SDA, soft SPI a write of CLK. */
+		unsigned int gpio_cost_ns = panel->bus == SIM_BUS_I2C ? cost->gpio_dir_ns : cost->gpio_value_ns;
+		bus_timing_set_speed(rate_hz);
+		ns += (double)s->ndelay_calls * bus_timing_delay_ns(0, gpio_cost_ns);
+		bus_timing_set_speed(speed_hz);
+	} else {
+		ns += (double)s->ndelay_ns;
+	}
+	return ns;
+}
+
+static unsigned char print_hashes = 0;
+static unsigned char verbose = 0;
+
+static void print_header(void)
+{
+	size_t i;
+	if (print_hashes) {
+		printf("%-20s %-9s %6s %16s %16s\n", "controller", "scenario", "frames", "panel ram", "bus");
+		return;
+	}
+	printf("%-20s %-9s %6s %9s %7s %9s %7s %9s %9s", "controller", "scenario", "frames", "bytes/f", "xfer/f", "gpio/f", "gpio/B", "peak B", "allocs/f");
+	for (i = 0; i < sizeof(bus_rates) / sizeof(bus_rates[0]); i++)
+		printf(" %8s", bus_rate_names[i]);
+	printf("\n");
+}
+
+static void print_result(const struct bench_panel *panel, const struct bench_scenario *scenario, const struct bench_result *r)
+{
+	const struct sim_stats *t = &r->total;
+	double frames = r->frames ? r->frames : 1;
+	double gpio_calls;
+	size_t i;
+	if (print_hashes) {
+		printf("%-20s %-9s %6u %016llx %016llx\n", panel->name, scenario->name, r->frames,
+			panel->model != SIM_PANEL_NONE ? r->ram_hash : 0ULL, r->bus_hash);
+		return;
+	}
+	gpio_calls = t->gpio_dir_calls + t->gpio_set_calls + t->gpio_get_calls;
+	printf("%-20s %-9s %6u %9.1f %7.1f %9.1f %7.1f %9llu %9.2f", panel->name, scenario->name, r->frames,
+		t->bytes / frames, t->transactions / frames, gpio_calls / frames,
+		t->bytes ? gpio_calls / t->bytes : 0.0, r->peak.bytes, t->allocs / frames);
+	for (i = 0; i < sizeof(bus_rates) / sizeof(bus_rates[0]); i++) {
+		if (!panel->native_delay && i)
+			printf(" %8s", "-");
+		else
+			printf(" %8.3f", estimate_ns(panel, t, bus_rates[i]) / frames / 1000000.0);
+	}
+	printf("\n");
+}
+
+#define GLYPH_ITERATIONS	20000
+
+/* Linear scan of a decode table, the lookup seg7_ctrl.c did before the glyph lookup tables. */
+static unsigned char glyph_scan(const led_bitmap *tab, unsigned int len, unsigned char ch)
+{
+	unsigned int i;
+	for (i = 0; i < len; i++)
+		if (tab[i].character == ch)
+			return tab[i].bitmap;
+	return 0;
+}
+
+static double elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1E9 + (now.tv_nsec - start->tv_nsec);
+}
+
+/*
+ * Per character cost of the glyph lookup, for the characters of a clock
+ * frame and of a scrolling title, and a check of the lookup tables against
+ * the scan for every character.
+ */
+static void run_glyph_bench(void)
+{
+	static const struct {
+		const char *name;
+		const led_bitmap *tab;
+		unsigned int len;
+	} tables[] = {
+		{ "tab1", LED_decode_tab1, LED_DECODE_LEN(LED_decode_tab1) },
+		{ "tab2", LED_decode_tab2, LED_DECODE_LEN(LED_decode_tab2) },
+		{ "tab3", LED_decode_tab3, LED_DECODE_LEN(LED_decode_tab3) },
+		{ "tab4", LED_decode_tab4, LED_DECODE_LEN(LED_decode_tab4) },
+		{ "tab5", LED_decode_tab5, LED_DECODE_LEN(LED_decode_tab5) },
+	};
+	static const unsigned char clock_chars[] = { 2, 3, 5, 9, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+	const unsigned int chars = sizeof(clock_chars) + sizeof(long_title) - 1;
+	volatile unsigned char sink = 0;
+	size_t t;
+
+	printf("%-8s %12s %12s %10s\n", "table", "scan ns/ch", "lut ns/ch", "mismatch");
+	for (t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+		u_int8 lut[256];
+		unsigned int i, j, mismatches = 0;
+		unsigned char acc = 0;
+		struct timespec start;
+		double scan_ns, lut_ns;
+
+		build_glyph_lut(lut, tables[t].tab, tables[t].len);
+		for (i = 0; i < 256; i++)
+			if (lut[i] != glyph_scan(tables[t].tab, tables[t].len, i))
+				mismatches++;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (j = 0; j < GLYPH_ITERATIONS; j++) {
+			for (i = 0; i < sizeof(clock_chars); i++)
+				acc ^= glyph_scan(tables[t].tab, tables[t].len, clock_chars[i] ^ (j & 0x80));
+			for (i = 0; i < sizeof(long_title) - 1; i++)
+				acc ^= glyph_scan(tables[t].tab, tables[t].len, long_title[i] ^ (j & 0x80));
+		}
+		scan_ns = elapsed_ns(&start);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (j = 0; j < GLYPH_ITERATIONS; j++) {
+			for (i = 0; i < sizeof(clock_chars); i++)
+				acc ^= lut[clock_chars[i] ^ (j & 0x80)];
+			for (i = 0; i < sizeof(long_title) - 1; i++)
+				acc ^= lut[(unsigned char)long_title[i] ^ (j & 0x80)];
+		}
+		lut_ns = elapsed_ns(&start);
+		sink ^= acc;
+
+		printf("%-8s %12.2f %12.2f %10u\n", tables[t].name, scan_ns / GLYPH_ITERATIONS / chars,
+			lut_ns / GLYPH_ITERATIONS / chars, mismatches);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-v] [-H] [-g] [-f hz] [-c controller] [-s scenario]\n", name);
+	fprintf(stderr, "  Times are estimated milliseconds per frame at each soft bus rate.\n");
+	fprintf(stderr, "  -f drives the soft protocols at the given bus frequency instead of the controller default.\n");
+	fprintf(stderr, "  -H prints hashes of the modelled panel RAM after every frame and of the bus traffic instead.\n");
+	fprintf(stderr, "  -g compares the 7 segment glyph lookup table against a linear scan of the decode table.\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *only_panel = NULL, *only_scenario = NULL;
+	size_t p, s;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vHgf:c:s:h")) != -1) {
+		switch (opt) {
+		case 'v':
+			sim_set_quiet(0);
+			verbose = 1;
+			break;
+		case 'H':
+			print_hashes = 1;
+			break;
+		case 'g':
+			run_glyph_bench();
+			return 0;
+		case 'f':
+			bus_timing_set_speed(strtoul(optarg, NULL, 0));
+			break;
+		case 'c':
+			only_panel = optarg;
+			break;
+		case 's':
+			only_scenario = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	print_header();
+	for (p = 0; p < sizeof(panels) / sizeof(panels[0]); p++) {
+		const struct bench_panel *panel = &panels[p];
+		struct controller_interface *controller;
+		if (only_panel && strcmp(only_panel, panel->name))
+			continue;
+		controller = setup_panel(panel);
+		if (!controller) {
+			printf("%-20s failed to initialize\n", panel->name);
+			continue;
+		}
+		for (s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+			struct bench_result result;
+			if (only_scenario && strcmp(only_scenario, scenarios[s].name))
+				continue;
+			if (scenarios[s].draw && !controller->get_framebuffer)
+				continue;
+			run_scenario(controller, &scenarios[s], &result);
+			print_result(panel, &scenarios[s], &result);
+		}
+		if (verbose && panel->bus == SIM_BUS_I2C) {
+			struct i2c_sw_stats i2c_stats;
+			i2c_sw_get_stats(&i2c_stats);
+			printf("%-20s i2c_sw: %lu ACKs, %lu without SCL check, %lu stretched, %lu timeouts, %lu NACKs\n", panel->name,
+				i2c_stats.acks, i2c_stats.fast_acks, i2c_stats.stretches, i2c_stats.timeouts, i2c_stats.nacks);
+		}
+		controller->set_power(0);
+		sim_kthread_run();
+	}
+
+	return 0;
+}
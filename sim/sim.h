@@ -0,0 +1,81 @@
+#ifndef __OPENVFD_SIM_H__
+#define __OPENVFD_SIM_H__
+
+/*
+ * Userspace model of the kernel services used by the OpenVFD protocols and
+ * controllers. GPIO, delay, I2C adapter and allocator calls are recorded so
+ * the cost of a display update can be measured without hardware.
+ */
+
+#define SIM_GPIO_MAX		64
+
+enum sim_bus_type {
+	SIM_BUS_NONE,
+	SIM_BUS_I2C,
+	SIM_BUS_SPI,
+};
+
+enum sim_bus_event {
+	SIM_BUS_START,
+	SIM_BUS_BYTE,
+	SIM_BUS_STOP,
+};
+
+enum sim_panel_type {
+	SIM_PANEL_NONE,
+	SIM_PANEL_SSD1306,
+	SIM_PANEL_SH1106,
+	SIM_PANEL_PCD8544,
+	SIM_PANEL_IL3829,
+};
+
+struct sim_stats {
+	unsigned long long gpio_dir_calls;
+	unsigned long long gpio_set_calls;
+	unsigned long long gpio_get_calls;
+	unsigned long long pin_toggles;
+	unsigned long long bytes;
+	unsigned long long transactions;
+	unsigned long long delay_calls;
+	unsigned long long delay_ns;
+	unsigned long long ndelay_calls;	/* Subset of the delays above that went through ndelay(). */
+	unsigned long long ndelay_ns;
+	unsigned long long sleep_ns;
+	unsigned long long bus_ns;
+	unsigned long long allocs;
+	unsigned long long alloc_bytes;
+};
+
+struct sim_cost {
+	unsigned int gpio_dir_ns;	/* Cost of a gpio_direction_* call. */
+	unsigned int gpio_value_ns;	/* Cost of a gpio_{get,set}_value call. */
+	unsigned int hw_i2c_hz;		/* Clock of the simulated I2C adapter. */
+};
+
+typedef void (*sim_bus_listener)(enum sim_bus_event event, unsigned char data, void *ctx);
+
+void sim_reset(void);
+void sim_set_cost(const struct sim_cost *cost);
+const struct sim_cost *sim_get_cost(void);
+
+void sim_gpio_set_input(unsigned gpio, int level);
+int sim_gpio_level(unsigned gpio);
+int sim_gpio_is_output(unsigned gpio);
+
+void sim_bus_attach(enum sim_bus_type type, int clk, int dat, int stb, int lsb_first);
+void sim_bus_set_listener(sim_bus_listener listener, void *ctx);
+void sim_bus_set_ack(int ack);
+unsigned long long sim_bus_hash(void);
+
+void sim_panel_attach(enum sim_panel_type type, int is_i2c, int pin_dc);
+unsigned long long sim_panel_hash(unsigned long long hash);
+
+void sim_stats_reset(void);
+void sim_stats_get(struct sim_stats *stats);
+unsigned long long sim_time_ns(void);
+void sim_advance_ns(unsigned long long ns);
+
+void sim_set_quiet(int quiet);
+int sim_kthread_run(void);
+
+#endif
@@ -0,0 +1,648 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <linux/kernel.h>
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/i2c.h>
+#include <linux/spi/spi.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/interrupt.h>
+#include "sim.h"
+
+#define SIM_TASKS_MAX		4
+
+struct sim_pin {
+	unsigned char is_output;
+	unsigned char out_level;
+	unsigned char ext_level;	/* Level seen when the pin is released (pull-up or slave). */
+	unsigned char level;
+};
+
+struct sim_bus {
+	enum sim_bus_type type;
+	int clk;
+	int dat;
+	int stb;
+	int lsb_first;
+	int active;
+	int bit_count;
+	unsigned char data;
+	int ack;
+	int ack_driven;
+	sim_bus_listener listener;
+	void *ctx;
+};
+
+static const struct sim_cost default_cost = {
+	.gpio_dir_ns = 1000,
+	.gpio_value_ns = 250,
+	.hw_i2c_hz = 400000,
+};
+
+static struct sim_cost cost;
+static struct sim_pin pins[SIM_GPIO_MAX];
+static struct sim_bus bus;
+static struct sim_stats stats;
+static unsigned long long now_ns;
+static int quiet = 1;
+static struct i2c_adapter adapter = { .name = "sim-i2c" };
+static struct task_struct *tasks[SIM_TASKS_MAX];
+static int kthread_budget;
+static unsigned long long bus_hash;
+
+static void sim_bus_emit(enum sim_bus_event event, unsigned char data)
+{
+	bus_hash = (bus_hash ^ ((event << 8) | data)) * 0x100000001B3ULL;
+	if (bus.listener)
+		bus.listener(event, data, bus.ctx);
+}
+
+static void sim_pin_update(unsigned gpio, int count_toggle);
+
+static void sim_bus_byte(unsigned char data)
+{
+	stats.bytes++;
+	sim_bus_emit(SIM_BUS_BYTE, data);
+}
+
+static void sim_bus_sample(void)
+{
+	int bit = pins[bus.dat].level;
+	if (bus.lsb_first)
+		bus.data = (bus.data >> 1) | (bit ? 0x80 : 0x00);
+	else
+		bus.data = (bus.data << 1) | (bit ? 0x01 : 0x00);
+	if (++bus.bit_count == 8 && bus.type == SIM_BUS_SPI) {
+		sim_bus_byte(bus.data);
+		bus.bit_count = 0;
+	}
+}
+
+static void sim_slave_drive_sda(int level)
+{
+	pins[bus.dat].ext_level = level;
+	sim_pin_update(bus.dat, 0);
+}
+
+static void sim_bus_i2c_edge(unsigned gpio, int old_level, int level)
+{
+	if (gpio == bus.dat && pins[bus.clk].level && !bus.ack_driven) {
+		if (!level) {
+			if (!bus.active)
+				stats.transactions++;
+			bus.active = 1;
+			bus.bit_count = 0;
+			sim_bus_emit(SIM_BUS_START, 0);
+		} else if (bus.active) {
+			bus.active = 0;
+			sim_bus_emit(SIM_BUS_STOP, 0);
+		}
+	} else if (gpio == bus.clk && bus.active) {
+		if (level) {
+			if (bus.bit_count < 8) {
+				sim_bus_sample();
+				if (bus.bit_count == 8)
+					sim_bus_byte(bus.data);
+			} else {
+				bus.bit_count = 9;
+			}
+		} else if (bus.bit_count == 8 && bus.ack) {
+			bus.ack_driven = 1;
+			sim_slave_drive_sda(0);
+		} else if (bus.bit_count == 9) {
+			bus.bit_count = 0;
+			if (bus.ack_driven) {
+				sim_slave_drive_sda(1);
+				bus.ack_driven = 0;
+			}
+		}
+	}
+}
+
+static void sim_bus_spi_edge(unsigned gpio, int old_level, int level)
+{
+	if (gpio == bus.stb) {
+		if (!level) {
+			stats.transactions++;
+			bus.active = 1;
+			bus.bit_count = 0;
+			sim_bus_emit(SIM_BUS_START, 0);
+		} else if (bus.active) {
+			bus.active = 0;
+			sim_bus_emit(SIM_BUS_STOP, 0);
+		}
+	} else if (gpio == bus.clk && bus.active && level) {
+		sim_bus_sample();
+	}
+}
+
+static void sim_pin_update(unsigned gpio, int count_toggle)
+{
+	struct sim_pin *pin = &pins[gpio];
+	int old_level = pin->level;
+	pin->level = pin->is_output ? pin->out_level : pin->ext_level;
+	if (pin->level == old_level)
+		return;
+	if (count_toggle)
+		stats.pin_toggles++;
+	if (bus.type == SIM_BUS_I2C && (gpio == bus.clk || gpio == bus.dat))
+		sim_bus_i2c_edge(gpio, old_level, pin->level);
+	else if (bus.type == SIM_BUS_SPI && (gpio == bus.clk || gpio == bus.stb))
+		sim_bus_spi_edge(gpio, old_level, pin->level);
+}
+
+void sim_reset(void)
+{
+	unsigned i;
+	for (i = 0; i < SIM_TASKS_MAX; i++) {
+		free(tasks[i]);
+		tasks[i] = NULL;
+	}
+	memset(&bus, 0, sizeof(bus));
+	for (i = 0; i < SIM_GPIO_MAX; i++) {
+		pins[i].is_output = 0;
+		pins[i].out_level = 0;
+		pins[i].ext_level = 1;
+		pins[i].level = 1;
+	}
+	cost = default_cost;
+	now_ns = 0;
+	kthread_budget = 0;
+	bus_hash = 0xCBF29CE484222325ULL;
+	sim_stats_reset();
+}
+
+void sim_set_cost(const struct sim_cost *_cost)
+{
+	cost = *_cost;
+}
+
+const struct sim_cost *sim_get_cost(void)
+{
+	return &cost;
+}
+
+void sim_gpio_set_input(unsigned gpio, int level)
+{
+	if (gpio < SIM_GPIO_MAX) {
+		pins[gpio].ext_level = level ? 1 : 0;
+		sim_pin_update(gpio, 0);
+	}
+}
+
+int sim_gpio_level(unsigned gpio)
+{
+	return gpio < SIM_GPIO_MAX ? pins[gpio].level : 0;
+}
+
+int sim_gpio_is_output(unsigned gpio)
+{
+	return gpio < SIM_GPIO_MAX ? pins[gpio].is_output : 0;
+}
+
+void sim_bus_attach(enum sim_bus_type type, int clk, int dat, int stb, int lsb_first)
+{
+	sim_bus_listener listener = bus.listener;
+	void *ctx = bus.ctx;
+	memset(&bus, 0, sizeof(bus));
+	if (clk < 0 || clk >= SIM_GPIO_MAX || dat < 0 || dat >= SIM_GPIO_MAX)
+		type = SIM_BUS_NONE;
+	if (type == SIM_BUS_SPI && (stb < 0 || stb >= SIM_GPIO_MAX))
+		type = SIM_BUS_NONE;
+	bus.type = type;
+	bus.clk = clk;
+	bus.dat = dat;
+	bus.stb = stb;
+	bus.lsb_first = lsb_first;
+	bus.ack = 1;
+	bus.listener = listener;
+	bus.ctx = ctx;
+}
+
+void sim_bus_set_listener(sim_bus_listener listener, void *ctx)
+{
+	bus.listener = listener;
+	bus.ctx = ctx;
+}
+
+unsigned long long sim_bus_hash(void)
+{
+	return bus_hash;
+}
+
+void sim_bus_set_ack(int ack)
+{
+	bus.ack = ack;
+}
+
+void sim_stats_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void sim_stats_get(struct sim_stats *_stats)
+{
+	*_stats = stats;
+}
+
+unsigned long long sim_time_ns(void)
+{
+	return now_ns;
+}
+
+u64 ktime_get_ns(void)
+{
+	return now_ns;
+}
+
+void sim_advance_ns(unsigned long long ns)
+{
+	now_ns += ns;
+}
+
+void sim_set_quiet(int _quiet)
+{
+	quiet = _quiet;
+}
+
+int sim_kthread_run(void)
+{
+	int i, count = 0;
+	for (i = 0; i < SIM_TASKS_MAX; i++) {
+		if (tasks[i]) {
+			kthread_budget = 1;
+			tasks[i]->threadfn(tasks[i]->data);
+			count++;
+		}
+	}
+	kthread_budget = 0;
+	return count;
+}
+
+/*
+ * Kernel services.
+ */
+
+int printk(const char *fmt, ...)
+{
+	int ret = 0;
+	if (!quiet) {
+		va_list args;
+		va_start(args, fmt);
+		ret = vprintf(fmt, args);
+		va_end(args);
+	}
+	return ret;
+}
+
+int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	int ret;
+	va_list args;
+	if (!size)
+		return 0;
+	va_start(args, fmt);
+	ret = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	if (ret < 0)
+		return 0;
+	return (size_t)ret >= size ? (int)size - 1 : ret;
+}
+
+int gpio_direction_output(unsigned gpio, int value)
+{
+	stats.gpio_dir_calls++;
+	now_ns += cost.gpio_dir_ns;
+	if (gpio < SIM_GPIO_MAX) {
+		pins[gpio].is_output = 1;
+		pins[gpio].out_level = value ? 1 : 0;
+		sim_pin_update(gpio, 1);
+	}
+	return 0;
+}
+
+int gpio_direction_input(unsigned gpio)
+{
+	stats.gpio_dir_calls++;
+	now_ns += cost.gpio_dir_ns;
+	if (gpio < SIM_GPIO_MAX) {
+		pins[gpio].is_output = 0;
+		sim_pin_update(gpio, 1);
+	}
+	return 0;
+}
+
+int gpio_get_value(unsigned gpio)
+{
+	stats.gpio_get_calls++;
+	now_ns += cost.gpio_value_ns;
+	return gpio < SIM_GPIO_MAX ? pins[gpio].level : 0;
+}
+
+void gpio_set_value(unsigned gpio, int value)
+{
+	stats.gpio_set_calls++;
+	now_ns += cost.gpio_value_ns;
+	if (gpio < SIM_GPIO_MAX) {
+		pins[gpio].out_level = value ? 1 : 0;
+		sim_pin_update(gpio, 1);
+	}
+}
+
+/*
+ * Descriptors are just the pin number, an array update is one call that
+ * latches every line.
+ */
+struct gpio_desc {
+	unsigned gpio;
+};
+
+static struct gpio_desc descs[SIM_GPIO_MAX];
+
+struct gpio_desc *gpio_to_desc(unsigned gpio)
+{
+	if (gpio >= SIM_GPIO_MAX)
+		return NULL;
+	descs[gpio].gpio = gpio;
+	return &descs[gpio];
+}
+
+int desc_to_gpio(const struct gpio_desc *desc)
+{
+	return desc ? (int)desc->gpio : -1;
+}
+
+int gpiod_set_array_value(unsigned int array_size, struct gpio_desc **desc_array,
+			  struct gpio_array *array_info, unsigned long *value_bitmap)
+{
+	unsigned int i;
+	stats.gpio_set_calls++;
+	now_ns += cost.gpio_value_ns;
+	for (i = 0; i < array_size; i++)
+		pins[desc_array[i]->gpio].out_level = (*value_bitmap >> i) & 1;
+	for (i = 0; i < array_size; i++)
+		sim_pin_update(desc_array[i]->gpio, 1);
+	return 0;
+}
+
+static void sim_delay(unsigned long long nsecs)
+{
+	stats.delay_calls++;
+	stats.delay_ns += nsecs;
+	now_ns += nsecs;
+}
+
+/* Only the soft protocol bit timing uses ndelay(), the bench rescales it per bus rate. */
+void ndelay(unsigned long nsecs)
+{
+	stats.ndelay_calls++;
+	stats.ndelay_ns += nsecs;
+	sim_delay(nsecs);
+}
+
+void udelay(unsigned long usecs)
+{
+	sim_delay(usecs * 1000ULL);
+}
+
+void mdelay(unsigned long msecs)
+{
+	sim_delay(msecs * 1000000ULL);
+}
+
+void msleep(unsigned int msecs)
+{
+	stats.sleep_ns += msecs * 1000000ULL;
+	now_ns += msecs * 1000000ULL;
+}
+
+void usleep_range(unsigned long min, unsigned long max)
+{
+	stats.sleep_ns += min * 1000ULL;
+	now_ns += min * 1000ULL;
+}
+
+/* The harness has no interrupt controller, drivers fall back to polling. */
+int gpio_to_irq(unsigned gpio)
+{
+	return -ENXIO;
+}
+
+int request_irq(unsigned int irq, irq_handler_t handler, unsigned long flags, const char *name, void *data)
+{
+	return -ENXIO;
+}
+
+const void *free_irq(unsigned int irq, void *data)
+{
+	return NULL;
+}
+
+long schedule_timeout(long timeout)
+{
+	msleep(jiffies_to_msecs(timeout));
+	return 0;
+}
+
+void *kmalloc(size_t size, gfp_t flags)
+{
+	stats.allocs++;
+	stats.alloc_bytes += size;
+	return malloc(size ? size : 1);
+}
+
+void *kzalloc(size_t size, gfp_t flags)
+{
+	stats.allocs++;
+	stats.alloc_bytes += size;
+	return calloc(1, size ? size : 1);
+}
+
+void kfree(const void *ptr)
+{
+	free((void *)ptr);
+}
+
+void *vmalloc_user(unsigned long size)
+{
+	void *addr = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+	stats.allocs++;
+	stats.alloc_bytes += size;
+	if (addr)
+		memset(addr, 0, PAGE_ALIGN(size));
+	return addr;
+}
+
+void vfree(const void *addr)
+{
+	free((void *)addr);
+}
+
+struct i2c_adapter *i2c_get_adapter(int nr)
+{
+	return &adapter;
+}
+
+void i2c_put_adapter(struct i2c_adapter *adap)
+{
+}
+
+int i2c_check_functionality(struct i2c_adapter *adap, unsigned int func)
+{
+	return (func & (I2C_FUNC_I2C | I2C_FUNC_NOSTART)) == func;
+}
+
+int i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs, int num)
+{
+	unsigned long long bits = 2;
+	int i, j;
+	stats.transactions++;
+	for (i = 0; i < num; i++) {
+		unsigned int addr_len = (msgs[i].flags & I2C_M_TEN) ? 2 : 1;
+		if (!(msgs[i].flags & I2C_M_NOSTART)) {
+			sim_bus_emit(SIM_BUS_START, 0);
+			sim_bus_emit(SIM_BUS_BYTE, (msgs[i].addr << 1) | ((msgs[i].flags & I2C_M_RD) ? 1 : 0));
+			stats.bytes += addr_len;
+			bits += 9 * addr_len + (i ? 1 : 0);
+		}
+		for (j = 0; j < msgs[i].len; j++) {
+			if (msgs[i].flags & I2C_M_RD)
+				msgs[i].buf[j] = 0xFF;
+			else
+				sim_bus_emit(SIM_BUS_BYTE, msgs[i].buf[j]);
+		}
+		stats.bytes += msgs[i].len;
+		bits += 9ULL * msgs[i].len;
+	}
+	sim_bus_emit(SIM_BUS_STOP, 0);
+	bits = bits * 1000000000ULL / (cost.hw_i2c_hz ? cost.hw_i2c_hz : 100000);
+	stats.bus_ns += bits;
+	now_ns += bits;
+	return num;
+}
+
+/*
+ * A single SPI controller on bus 0. Messages are emitted to the listener
+ * the same way the SPI decoder reports bit-banged traffic.
+ */
+static struct spi_controller spi_controller = { .bus_num = 0, .dev = { .init_name = "sim-spi" } };
+
+struct spi_controller *spi_busnum_to_master(unsigned short bus_num)
+{
+	return bus_num == spi_controller.bus_num ? &spi_controller : NULL;
+}
+
+struct spi_device *spi_new_device(struct spi_controller *ctlr, struct spi_board_info *chip)
+{
+	struct spi_device *spi = calloc(1, sizeof(*spi));
+	if (spi) {
+		spi->dev.init_name = "spi0.0";
+		spi->controller = ctlr;
+		spi->max_speed_hz = chip->max_speed_hz;
+		spi->chip_select = chip->chip_select;
+		spi->mode = chip->mode;
+	}
+	return spi;
+}
+
+void spi_unregister_device(struct spi_device *spi)
+{
+	free(spi);
+}
+
+int spi_setup(struct spi_device *spi)
+{
+	return spi->max_speed_hz ? 0 : -EINVAL;
+}
+
+int spi_sync(struct spi_device *spi, struct spi_message *message)
+{
+	struct spi_transfer *t;
+	unsigned long long bits = 0;
+	unsigned int i;
+	stats.transactions++;
+	sim_bus_emit(SIM_BUS_START, 0);
+	list_for_each_entry(t, &message->transfers, transfer_list) {
+		const unsigned char *tx = t->tx_buf;
+		unsigned char *rx = t->rx_buf;
+		for (i = 0; i < t->len; i++) {
+			if (tx)
+				sim_bus_emit(SIM_BUS_BYTE, tx[i]);
+			if (rx)
+				rx[i] = 0xFF;
+		}
+		stats.bytes += t->len;
+		bits += 8ULL * t->len;
+	}
+	sim_bus_emit(SIM_BUS_STOP, 0);
+	bits = bits * 1000000000ULL / spi->max_speed_hz;
+	stats.bus_ns += bits;
+	now_ns += bits;
+	return 0;
+}
+
+int spi_register_driver(struct spi_driver *sdrv)
+{
+	return 0;
+}
+
+void spi_unregister_driver(struct spi_driver *sdrv)
+{
+}
+
+unsigned long sim_jiffies(void)
+{
+	return (unsigned long)(now_ns / 1000000ULL);
+}
+
+struct task_struct *sim_kthread_create(int (*threadfn)(void *data), void *data)
+{
+	int i;
+	for (i = 0; i < SIM_TASKS_MAX; i++) {
+		if (!tasks[i]) {
+			tasks[i] = calloc(1, sizeof(*tasks[i]));
+			tasks[i]->threadfn = threadfn;
+			tasks[i]->data = data;
+			return tasks[i];
+		}
+	}
+	return NULL;
+}
+
+int wake_up_process(struct task_struct *task)
+{
+	return 1;
+}
+
+int kthread_stop(struct task_struct *task)
+{
+	int i;
+	for (i = 0; i < SIM_TASKS_MAX; i++) {
+		if (tasks[i] == task) {
+			free(task);
+			tasks[i] = NULL;
+		}
+	}
+	return 0;
+}
+
+int kthread_should_stop(void)
+{
+	if (kthread_budget > 0) {
+		kthread_budget--;
+		return 0;
+	}
+	return 1;
+}
+
+static void __attribute__((constructor)) sim_init(void)
+{
+	sim_reset();
+}
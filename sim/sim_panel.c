@@ -0,0 +1,255 @@
+#include <linux/kernel.h>
+#include "sim.h"
+
+/*
+ * Display RAM models fed from the decoded bus traffic. They only implement
+ * the addressing commands the controllers use, which is enough to tell
+ * whether two drivers leave the panel showing the same picture.
+ */
+
+#define PANEL_MAX_COLUMNS	132
+#define PANEL_MAX_PAGES		8
+#define EPD_MAX_BANKS		32
+#define EPD_MAX_ROWS		300
+
+struct sim_panel {
+	enum sim_panel_type type;
+	int is_i2c;
+	int pin_dc;
+	int byte_index;
+	int is_data;
+	unsigned char cmd;
+	int cmd_args;
+	unsigned char args[8];
+	int arg_count;
+	/* SSD1306 / SH1106 / PCD8544 */
+	unsigned char ram[PANEL_MAX_PAGES][PANEL_MAX_COLUMNS];
+	int horizontal;
+	int col, page;
+	int col_start, col_end, page_start, page_end;
+	int extended;
+	/* IL3829 */
+	unsigned char epd_ram[EPD_MAX_ROWS][EPD_MAX_BANKS];
+	int x, y;
+	int x_start, x_end, y_start, y_end;
+};
+
+static struct sim_panel panel;
+
+static void ssd1306_command_done(void)
+{
+	switch (panel.cmd) {
+	case 0x20:
+		panel.horizontal = (panel.args[0] & 0x03) == 0x00;
+		break;
+	case 0x21:
+		panel.col_start = panel.col = panel.args[0] & 0x7F;
+		panel.col_end = panel.args[1] & 0x7F;
+		break;
+	case 0x22:
+		panel.page_start = panel.page = panel.args[0] & 0x07;
+		panel.page_end = panel.args[1] & 0x07;
+		break;
+	}
+}
+
+static int ssd1306_command_args(unsigned char cmd)
+{
+	switch (cmd) {
+	case 0x20: case 0x81: case 0x8D: case 0xA8: case 0xAD: case 0xD3:
+	case 0xD5: case 0xD9: case 0xDA: case 0xDB:
+		return 1;
+	case 0x21: case 0x22:
+		return panel.type == SIM_PANEL_SSD1306 ? 2 : 0;
+	default:
+		return 0;
+	}
+}
+
+static void ssd1306_command(unsigned char cmd)
+{
+	if (panel.cmd_args) {
+		panel.args[panel.arg_count++] = cmd;
+		if (--panel.cmd_args == 0)
+			ssd1306_command_done();
+		return;
+	}
+	panel.cmd = cmd;
+	panel.arg_count = 0;
+	panel.cmd_args = ssd1306_command_args(cmd);
+	if (panel.cmd_args || (panel.type == SIM_PANEL_SSD1306 && panel.horizontal))
+		return;
+	if (cmd >= 0xB0 && cmd <= 0xB7)
+		panel.page = cmd & 0x07;
+	else if (cmd <= 0x0F)
+		panel.col = (panel.col & 0xF0) | cmd;
+	else if (cmd >= 0x10 && cmd <= 0x1F)
+		panel.col = (panel.col & 0x0F) | ((cmd & 0x0F) << 4);
+}
+
+static void ssd1306_data(unsigned char data)
+{
+	if (panel.page < PANEL_MAX_PAGES && panel.col < PANEL_MAX_COLUMNS)
+		panel.ram[panel.page][panel.col] = data;
+	if (panel.type == SIM_PANEL_SSD1306 && panel.horizontal) {
+		if (++panel.col > panel.col_end) {
+			panel.col = panel.col_start;
+			if (++panel.page > panel.page_end)
+				panel.page = panel.page_start;
+		}
+	} else if (panel.col < PANEL_MAX_COLUMNS - 1) {
+		panel.col++;
+	}
+}
+
+static void pcd8544_command(unsigned char cmd)
+{
+	if ((cmd & 0xF8) == 0x20) {
+		panel.extended = cmd & 0x01;
+	} else if (!panel.extended) {
+		if ((cmd & 0xF8) == 0x40)
+			panel.page = cmd & 0x07;
+		else if (cmd & 0x80)
+			panel.col = cmd & 0x7F;
+	}
+}
+
+static void pcd8544_data(unsigned char data)
+{
+	if (panel.page < 6 && panel.col < 84)
+		panel.ram[panel.page][panel.col] = data;
+	if (++panel.col >= 84) {
+		panel.col = 0;
+		if (++panel.page >= 6)
+			panel.page = 0;
+	}
+}
+
+static void il3829_command(unsigned char cmd)
+{
+	panel.cmd = cmd;
+	panel.arg_count = 0;
+}
+
+static void il3829_data(unsigned char data)
+{
+	if (panel.cmd == 0x24) {
+		if (panel.y < EPD_MAX_ROWS && panel.x < EPD_MAX_BANKS)
+			panel.epd_ram[panel.y][panel.x] = data;
+		if (++panel.x > panel.x_end) {
+			panel.x = panel.x_start;
+			if (++panel.y > panel.y_end)
+				panel.y = panel.y_start;
+		}
+		return;
+	}
+	if (panel.arg_count < (int)sizeof(panel.args))
+		panel.args[panel.arg_count++] = data;
+	switch (panel.cmd) {
+	case 0x44:
+		if (panel.arg_count == 2) {
+			panel.x_start = panel.args[0];
+			panel.x_end = panel.args[1];
+		}
+		break;
+	case 0x45:
+		if (panel.arg_count == 4) {
+			panel.y_start = panel.args[0] | (panel.args[1] << 8);
+			panel.y_end = panel.args[2] | (panel.args[3] << 8);
+		}
+		break;
+	case 0x4E:
+		panel.x = panel.args[0];
+		break;
+	case 0x4F:
+		if (panel.arg_count == 2)
+			panel.y = panel.args[0] | (panel.args[1] << 8);
+		break;
+	}
+}
+
+static void panel_byte(unsigned char data, int is_data)
+{
+	switch (panel.type) {
+	case SIM_PANEL_SSD1306:
+	case SIM_PANEL_SH1106:
+		if (is_data)
+			ssd1306_data(data);
+		else
+			ssd1306_command(data);
+		break;
+	case SIM_PANEL_PCD8544:
+		if (is_data)
+			pcd8544_data(data);
+		else
+			pcd8544_command(data);
+		break;
+	case SIM_PANEL_IL3829:
+		if (is_data)
+			il3829_data(data);
+		else
+			il3829_command(data);
+		break;
+	default:
+		break;
+	}
+}
+
+static void panel_listener(enum sim_bus_event event, unsigned char data, void *ctx)
+{
+	switch (event) {
+	case SIM_BUS_START:
+		panel.byte_index = 0;
+		break;
+	case SIM_BUS_BYTE:
+		if (panel.is_i2c) {
+			/* Address, control byte, then payload. */
+			if (panel.byte_index == 1)
+				panel.is_data = data & 0x40 ? 1 : 0;
+			else if (panel.byte_index > 1)
+				panel_byte(data, panel.is_data);
+		} else {
+			panel_byte(data, sim_gpio_level(panel.pin_dc));
+		}
+		panel.byte_index++;
+		break;
+	case SIM_BUS_STOP:
+		break;
+	}
+}
+
+void sim_panel_attach(enum sim_panel_type type, int is_i2c, int pin_dc)
+{
+	memset(&panel, 0, sizeof(panel));
+	panel.type = type;
+	panel.is_i2c = is_i2c;
+	panel.pin_dc = pin_dc;
+	panel.col_end = PANEL_MAX_COLUMNS - 1;
+	panel.page_end = PANEL_MAX_PAGES - 1;
+	sim_bus_set_listener(type != SIM_PANEL_NONE ? panel_listener : NULL, NULL);
+}
+
+unsigned long long sim_panel_hash(unsigned long long hash)
+{
+	const unsigned char *p;
+	size_t i, size;
+	switch (panel.type) {
+	case SIM_PANEL_SSD1306:
+	case SIM_PANEL_SH1106:
+	case SIM_PANEL_PCD8544:
+		p = &panel.ram[0][0];
+		size = sizeof(panel.ram);
+		break;
+	case SIM_PANEL_IL3829:
+		p = &panel.epd_ram[0][0];
+		size = sizeof(panel.epd_ram);
+		break;
+	default:
+		return hash;
+	}
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}